@@ -1,17 +1,21 @@
-#include "client.h"
+#include "twitse.h"
 #include "multicast.h"
 #include "log.h"
 #include "interface.h"
 #include "globals.h"
+#include "systemtime.h"
 
 #include <csignal>
 #include <execinfo.h>
 #include <QCommandLineParser>
+#include <QCoreApplication>
 
 std::shared_ptr<spdlog::logger> trace = spdlog::stdout_color_mt("console");
 
 int g_developmentMask = DevelopmentMask::None;
 
+SystemTime* s_systemTime = nullptr;
+
 void signalHandler(int signal)
 {
     void *array[100];
@@ -47,6 +51,10 @@ int main(int argc, char *argv[])
                           {"noclockadj", "dont adjust the clock"},
                           // can be set at runtime with control application
                           {"fixedadjust", "use a fixed ppm value", "fixedadjust"},
+                          {"peer", "run direct measurements against the client with this name", "peer"},
+                          {"peersteer", "steer the clock towards the peer given with --peer, only for the client with the highest name in the pair"},
+                          {"notimepage", "dont publish the time page for local consumers (software build)"},
+                          {"kerneldiscipline", "let the kernel run the clock at the corrected rate rather than stepping it (software build)"},
                           {"loglevel", "0:error 1:info(default) 2:debug 3:all", "loglevel"}
                       });
     parser.process(app);
@@ -73,16 +81,14 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    int loglevelOption = parser.value("loglevel").isEmpty() ? 1 : parser.value("loglevel").toInt();
     spdlog::level::level_enum loglevel = spdlog::level::info;
-    if (!parser.value("loglevel").isEmpty())
+    switch (loglevelOption)
     {
-        switch (parser.value("loglevel").toInt())
-        {
-        case 0 : loglevel = spdlog::level::err; break;
-        case 2 : loglevel = spdlog::level::debug; break;
-        case 3 : loglevel = spdlog::level::trace; break;
-        default : break;
-        }
+    case 0 : loglevel = spdlog::level::err; break;
+    case 2 : loglevel = spdlog::level::debug; break;
+    case 3 : loglevel = spdlog::level::trace; break;
+    default : break;
     }
     spdlog::set_level(loglevel);
     spdlog::set_pattern(logformat);
@@ -104,7 +110,31 @@ int main(int argc, char *argv[])
         trace->critical("unable to set realtime priority");
     }
 
-    Client client(&app, id, address, port, loglevel, no_clock_adj, !use_fixed_adjust, fixed_adjust);
+    Twitse::Options options;
+    options.m_id = id.toStdString();
+    options.m_port = port;
+    options.m_noClockAdjust = no_clock_adj;
+    options.m_useFixedAdjust = use_fixed_adjust;
+    options.m_fixedAdjust = fixed_adjust;
+    options.m_peer = parser.value("peer").toStdString();
+    options.m_peerSteer = parser.isSet("peersteer");
+    options.m_sharedTimePage = !parser.isSet("notimepage");
+    options.m_kernelDiscipline = parser.isSet("kerneldiscipline");
+    options.m_logLevel = loglevelOption;
+
+    // the client runs in a thread of its own which inherits the realtime priority. A kill from
+    // the control application stops it and then the application.
+    Twitse twitse;
+    if (!twitse.start(options, [&app](Twitse::State state)
+        {
+            if (state == Twitse::STOPPED)
+            {
+                QMetaObject::invokeMethod(&app, "quit", Qt::QueuedConnection);
+            }
+        }))
+    {
+        exit(1);
+    }
 
     return QCoreApplication::exec();
 }
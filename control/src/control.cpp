@@ -39,6 +39,122 @@ Control::Control(QCoreApplication *parent, QCommandLineParser& parser, const QHo
             {"value", parser.value("silence")}});
         m_multicast->tx(tx);
     }
+    if (parser.isSet("servo") || parser.isSet("servoparameters"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "servo"},
+            {"client", client_name},
+            {"value", parser.value("servo")},
+            {"parameters", parser.value("servoparameters")}});
+        m_multicast->tx(tx);
+    }
+    if (parser.isSet("filter"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "filter"},
+            {"client", client_name},
+            {"value", parser.value("filter")}});
+        m_multicast->tx(tx);
+    }
+    if (parser.isSet("shadow"))
+    {
+        MulticastTxPacket server(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "shadow"},
+            {"client", client_name},
+            {"value", parser.value("shadow")}});
+        m_multicast->tx(server);
+
+        MulticastTxPacket client(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", client_name.isEmpty() ? QString("all") : client_name},
+            {"action", "shadow"},
+            {"value", parser.value("shadow")}});
+        m_multicast->tx(client);
+    }
+    if (parser.isSet("driftestimator"))
+    {
+        MulticastTxPacket server(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "driftestimator"},
+            {"client", client_name},
+            {"value", parser.value("driftestimator")}});
+        m_multicast->tx(server);
+
+        MulticastTxPacket client(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", client_name.isEmpty() ? QString("all") : client_name},
+            {"action", "driftestimator"},
+            {"value", parser.value("driftestimator")}});
+        m_multicast->tx(client);
+    }
+    if (parser.isSet("joint"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "joint"},
+            {"client", client_name},
+            {"value", parser.value("joint")}});
+        m_multicast->tx(tx);
+    }
+    if (parser.isSet("probe"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "probe"},
+            {"client", client_name},
+            {"value", parser.value("probe")}});
+        m_multicast->tx(tx);
+    }
+    if (parser.isSet("burstabort"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "burstabort"},
+            {"client", client_name},
+            {"value", parser.value("burstabort")}});
+        m_multicast->tx(tx);
+    }
+    if (parser.isSet("pipeline"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "pipeline"},
+            {"client", client_name},
+            {"value", parser.value("pipeline")}});
+        m_multicast->tx(tx);
+    }
+    if (parser.isSet("fastacquisition"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "fastacquisition"},
+            {"client", client_name},
+            {"value", parser.value("fastacquisition")}});
+        m_multicast->tx(tx);
+    }
     if (parser.isSet("kill"))
     {
         MulticastTxPacket tx(KeyVal{
@@ -48,6 +164,28 @@ Control::Control(QCoreApplication *parent, QCommandLineParser& parser, const QHo
             {"action", "kill"}});
         m_multicast->tx(tx);
     }
+    if (parser.isSet("event"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", "server"},
+            {"action", "event"},
+            {"client", client_name},
+            {"value", parser.value("event")},
+            {"delay", parser.value("eventdelay")}});
+        m_multicast->tx(tx);
+    }
+    if (parser.isSet("kerneldiscipline"))
+    {
+        MulticastTxPacket tx(KeyVal{
+            {"from", "control"},
+            {"command", "control"},
+            {"to", client_name.isEmpty() ? QString("all") : client_name},
+            {"action", "kerneldiscipline"},
+            {"value", parser.value("kerneldiscipline")}});
+        m_multicast->tx(tx);
+    }
     if (parser.isSet("vctcxodac"))
     {
         if (client_name.isEmpty())
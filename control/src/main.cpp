@@ -30,6 +30,19 @@ int main(int argc, char *argv[])
                  "after which systemd will default restart them again", "target"},
         {"silence", "(server) silence in secs between measurements, 0-20 or auto", "silence"},
         {"samples", "(server) number of samples per measurement, 0-1000 or auto", "samples"},
+        {"servo", "(server) clock servo default, pi or deadband. For all clients or the one given with --client", "servo"},
+        {"servoparameters", "(server) servo parameters as key=value,.. e.g. kp=0.0025,ki=0.00002", "servoparameters"},
+        {"filter", "(server and client) sample filter e.g. 'largest bin window' (default), 'lowest values', 'low percentile' or 'auto' for automatic selection. For all clients or the one given with --client", "filter"},
+        {"shadow", "(server and client) run the filters 'a,b,..', 'all' or 'off' in shadow mode. For all clients or the one given with --client", "shadow"},
+        {"driftestimator", "(server and client) drift estimator for the ppm regression, ls, wls (default) or theilsen. For all clients or the one given with --client", "driftestimator"},
+        {"joint", "(server) 'on' or 'off' (default), offsets from matched packet pairs using the raw client timestamps. For all clients or the one given with --client", "joint"},
+        {"probe", "(server) 'on' or 'off' (default), start bursts with a short probe that sizes the burst or postpones it on congestion. For all clients or the one given with --client", "probe"},
+        {"burstabort", "(server) 'on' (default) or 'off', abort bursts early when the channel is congested. For all clients or the one given with --client", "burstabort"},
+        {"pipeline", "(server) 'on' (default) or 'off', pipelined control exchange after a burst. For all clients or the one given with --client", "pipeline"},
+        {"fastacquisition", "(server) 'on' (default) or 'off', short back to back bursts until a new client is running. For all clients or the one given with --client", "fastacquisition"},
+        {"kerneldiscipline", "(client) 'on' or 'off' (default), let the kernel run the clock at the corrected rate (software build). For all clients or the one given with --client", "kerneldiscipline"},
+        {"event", "(server) fire the named event on all clients, or the one given with --client, at the same server time", "event"},
+        {"eventdelay", "(server) delay in ms from now until the event given with --event fires, default 1000", "eventdelay"},
         {"vctcxodac", "(client) set the vctcxo dac to fixed value 0-65535 or auto", "vctcxodac"},
         {"client", "name of the client (for entries starting with '(client)')", "client"}});
 
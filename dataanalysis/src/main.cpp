@@ -3,9 +3,11 @@
 #include "log.h"
 #include "globals.h"
 #include "basicoffsetmeasurement.h"
+#include "clockservo.h"
 
 #include <QProcess>
 #include <QDir>
+#include <memory>
 
 int g_developmentMask = DevelopmentMask::None;
 
@@ -46,6 +48,8 @@ int main(int argc, char *argv[])
     MeasurementSeriesBase* server_timing = new BasicMeasurementSeries("server", MeasurementSeriesBase::LOWEST_VALUES);
     MeasurementSeriesBase* client_timing = new BasicMeasurementSeries("client", MeasurementSeriesBase::LOWEST_VALUES);
 
-    DataAnalyse data(server_timing, client_timing, serverfiles, clientfiles);
+    std::unique_ptr<ClockServo> servo(ClockServo::create(ClockServo::PROPORTIONAL_INTEGRAL, "[analysis] "));
+
+    DataAnalyse data(server_timing, client_timing, servo.get(), serverfiles, clientfiles);
     trace->info("exit");
 }
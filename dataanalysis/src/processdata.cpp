@@ -13,10 +13,12 @@ SystemTime* s_systemTime = nullptr;
 
 DataAnalyse::DataAnalyse(MeasurementSeriesBase* server_calc,
                          MeasurementSeriesBase *client_calc,
+                         ClockServo* servo,
                          const QStringList &serverfiles,
                          const QStringList &clientfiles)
 {
     int index = 0;
+    double previous_offset_us = 0.0;
 
     OffsetMeasurementHistory server_offset_history;
     server_offset_history.setFlags(DevelopmentMask::AnalysisAppendToSummary);
@@ -28,6 +30,9 @@ DataAnalyse::DataAnalyse(MeasurementSeriesBase* server_calc,
         QString filename = QFile(serverfiles.at(i)).fileName();
         trace->info(WHITE "processing '{}'" RESET, filename.toStdString());
 
+        int64_t server2client_ns = 0;
+        int64_t client2server_ns = 0;
+
         {
             dataset samples = load(clientfiles.at(i));
             client_calc->prepareNewDataMeasurement();
@@ -37,8 +42,10 @@ DataAnalyse::DataAnalyse(MeasurementSeriesBase* server_calc,
                 client_calc->add(datas.at(0), datas.at(1));
             }
 
+            client_calc->setDriftEstimate(client_offset_history.getPPM());
             OffsetMeasurement offset_measurement = client_calc->calculate();
             client_offset_history.add(offset_measurement);
+            server2client_ns = offset_measurement.m_offset_ns;
         }
 
         {
@@ -50,11 +57,26 @@ DataAnalyse::DataAnalyse(MeasurementSeriesBase* server_calc,
                 server_calc->add(datas.at(0), datas.at(1));
             }
 
+            server_calc->setDriftEstimate(server_offset_history.getPPM());
             OffsetMeasurement offset_measurement = server_calc->calculate();
             server_offset_history.add(offset_measurement);
+            client2server_ns = offset_measurement.m_offset_ns;
         }
 
         trace->info(server_offset_history.clientToString(0));
+
+        // open loop, the servo output is shown but obviously can't change the canned data
+        double offset_us = (client2server_ns - server2client_ns) / 2000.0;
+        if (servo && server_offset_history.size() > 1)
+        {
+            ServoInput servoInput;
+            servoInput.offset_us = offset_us;
+            servoInput.previousOffset_us = previous_offset_us;
+            servoInput.deltaTime_sec = server_offset_history.getLastTimespan_sec();
+            double ppm = servo->adjust(servoInput);
+            trace->info("servo '{}' offset_us {:-7.3f} ppm adjustment {:-7.3f}", servo->name(), offset_us, ppm);
+        }
+        previous_offset_us = offset_us;
         index++;
     };
 
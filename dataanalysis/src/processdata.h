@@ -1,5 +1,6 @@
 #pragma once
 #include "basicoffsetmeasurement.h"
+#include "clockservo.h"
 #include <QCoreApplication>
 #include <QVector>
 
@@ -14,6 +15,7 @@ public:
 
     DataAnalyse(MeasurementSeriesBase* timingCalc,
                 MeasurementSeriesBase* client_calc,
+                ClockServo* servo,
                 const QStringList& serverfiles,
                 const QStringList &clientfiles);
 
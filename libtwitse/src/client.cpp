@@ -0,0 +1,1211 @@
+#include "client.h"
+#include "defaultdac.h"
+#include "log.h"
+#include "globals.h"
+#include "systemtime.h"
+#include "interface.h"
+#include "apputils.h"
+#include "i2c_access.h"
+#include "eventscheduler.h"
+#include "peerlink.h"
+#include "rawtimestamps.h"
+#include "system.h"
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QNetworkDatagram>
+#include <cmath>
+
+extern int g_developmentMask;
+extern int g_randomTrashPromille;
+
+
+Client::Client(QObject *parent, const QString& id,
+               const QHostAddress &address, uint16_t port,
+               spdlog::level::level_enum loglevel,
+               bool no_clock_adj, bool autoPPM_LSB, double fixedPPM_LSB)
+    : QObject(parent),
+      m_id(id),
+      m_logLevel(loglevel),
+      m_noClockAdj(no_clock_adj),
+      m_persistDriftState(autoPPM_LSB && !no_clock_adj),
+      m_shadowFilters(id.toStdString() + " ")
+{
+    s_systemTime = new SystemTime(false);
+
+    qRegisterMetaType<UdpRxPacketPtr>("UdpRxPacketPtr");
+    qRegisterMetaType<TcpRxPacketPtr>("TcpRxPacketPtr");
+    qRegisterMetaType<MulticastRxPacket>("MulticastRxPacket");
+
+    reset();
+
+    if (VCTCXO_MODE)
+    {
+        double luhab_temperature = I2C_Access::I2C()->readTemperature();
+        trace->info("luhab carrier board temperature is {:.1f} °C", luhab_temperature);
+
+        if (autoPPM_LSB)
+        {
+            I2C_Access::I2C()->writeVCTCXO_DAC(loadDefaultDAC());
+        }
+        else
+        {
+            I2C_Access::I2C()->writeVCTCXO_DAC(fixedPPM_LSB);
+            I2C_Access::I2C()->setFixedVCTCXO_DAC(true);
+            trace->info("setting fixed dac to to {}", fixedPPM_LSB);
+        }
+    }
+    else // software
+    {
+        if (!autoPPM_LSB)
+        {
+            s_systemTime->setPPM(fixedPPM_LSB);
+            m_autoPPMAdjust = false;
+            trace->info("setting fixed ppm/lsb to to {}", fixedPPM_LSB);
+        }
+    }
+
+    m_multicastThread = new QThread(this);
+    m_multicast = new Multicast(id, address, port);
+
+    m_multicast->moveToThread(m_multicastThread);
+    connect(m_multicast, &Multicast::rx, this, &Client::multicastRx);
+
+    m_multicastThread->start();
+
+    m_eventScheduler = new EventScheduler(this);
+    connect(m_eventScheduler, &EventScheduler::signalFired, this, &Client::slotEventFired);
+
+    sendServerConnectRequest();
+
+    m_SystemTimeRefreshTimer = startTimer(TIMER_20MS);
+    if (m_persistDriftState)
+    {
+        m_saveDriftStateTimer = startTimer(TIMER_5MIN);
+    }
+}
+
+
+Client::~Client()
+{
+    if (m_state == State::STATE_SYNCHRONIZED)
+    {
+        saveDriftState();
+    }
+
+    m_multicastThread->quit();
+    m_multicastThread->wait();
+    delete m_multicast;
+
+    delete m_measurementSeries;
+    I2C_Access::I2C()->exit();
+
+    delete s_systemTime;
+    s_systemTime = nullptr;
+}
+
+
+/// Join a peer group with another client, see PeerLink.
+///
+void Client::setPeer(const QString& peer, bool steer)
+{
+    m_peerLink = new PeerLink(this, m_id, peer, steer);
+
+    connect(m_peerLink, &PeerLink::signalMulticastTx, this, &Client::slotPeerMulticastTx);
+    connect(m_peerLink, &PeerLink::signalPeerOffset, this, &Client::slotPeerOffset);
+    connect(m_peerLink, &PeerLink::signalAdjustPPM, this, &Client::slotPeerAdjustPPM);
+}
+
+
+/// Software mode only, see SystemTime::setKernelDiscipline(). The kernel then keeps the clock
+/// in place by itself so the periodic clock refresh is no longer needed.
+///
+void Client::setKernelDiscipline(bool enabled)
+{
+#ifdef VCTCXO
+    trace->error("running in vctcxo mode, there is no kernel discipline here");
+#else
+    if (!s_systemTime->setKernelDiscipline(enabled))
+    {
+        return;
+    }
+    timerOff(this, m_SystemTimeRefreshTimer);
+    if (!enabled)
+    {
+        m_SystemTimeRefreshTimer = startTimer(TIMER_20MS);
+    }
+#endif
+}
+
+
+/// Schedule an event at the server time at_ns on this and all other clients, see EventScheduler.
+///
+void Client::scheduleEvent(const QString& name, qint64 at_ns)
+{
+    m_eventScheduler->schedule(name, at_ns);
+
+    QJsonObject json;
+    json["from"] = m_id;
+    json["to"] = "all";
+    json["command"] = "event";
+    json["action"] = "schedule";
+    json["name"] = name;
+    json["at"] = QString::number(at_ns);
+    multicastTx(MulticastTxPacket(json));
+}
+
+
+void Client::setEventCallback(std::function<void(const std::string& name, int64_t at_ns)> callback)
+{
+    m_eventScheduler->setFireCallback(callback);
+}
+
+
+/// The observed firing error goes to the server which adds its own view of the client offset.
+///
+void Client::slotEventFired(const QString& name, qint64 at_ns, qint64 late_ns)
+{
+    trace->info("event '{}' fired {:.1f} us late", name.toStdString(), late_ns / 1000.0);
+
+    if (m_connectionState == ConnectionState::CONNECTED)
+    {
+        QJsonObject json;
+        json["command"] = "eventfired";
+        json["name"] = name;
+        json["at"] = QString::number(at_ns);
+        json["late"] = QString::number(late_ns);
+        tcpTx(json);
+    }
+}
+
+
+Client::State Client::state() const
+{
+    return m_state;
+}
+
+
+void Client::setState(State state)
+{
+    if (state != m_state)
+    {
+        if (m_state == State::STATE_HOLDOVER)
+        {
+            timerOff(this, m_holdoverTimer);
+        }
+        m_state = state;
+        emit signalStateChanged(state);
+    }
+}
+
+
+void Client::slotPeerMulticastTx(const QJsonObject& json)
+{
+    multicastTx(MulticastTxPacket(json));
+}
+
+
+void Client::slotPeerOffset(const QString& peer, int64_t offset_ns)
+{
+    if (m_connectionState == ConnectionState::CONNECTED)
+    {
+        QJsonObject json;
+        json["command"] = "peeroffset";
+        json["peer"] = peer;
+        json["offset"] = QString::number(offset_ns);
+        tcpTx(json);
+    }
+}
+
+
+void Client::slotPeerAdjustPPM(double ppm)
+{
+    if (m_autoPPMAdjust && !m_noClockAdj)
+    {
+        adjustPPM(ppm);
+        m_eventScheduler->updateDeadlines();
+    }
+}
+
+
+void Client::reset()
+{
+    trace->debug("client is resetting");
+    closeServerConnection();
+    m_offsetMeasurementHistory.reset();
+    m_setInitialLocalPPM = true;
+    s_systemTime->reset();
+    setState(State::STATE_DISCONNECTED);
+    loadDriftState();
+
+    if (VCTCXO_MODE)
+    {
+        if (m_saveNewDefaultDAC != TIMEROFF)
+        {
+            killTimer(m_saveNewDefaultDAC);
+        }
+        m_saveNewDefaultDAC = startTimer(TIMER_5MIN);
+        I2C_Access::I2C()->writeVCTCXO_DAC(loadDefaultDAC());
+    }
+}
+
+
+/// The part of a reset that concerns the server, the local clock is left as it is.
+///
+void Client::closeServerConnection()
+{
+    m_connectionState = ConnectionState::NOT_CONNECTED;
+    delete m_measurementSeries;
+
+    m_measurementSeries = new BasicMeasurementSeries(m_id.toStdString());
+    m_tcpSocket.close();
+    if (m_udpSocket)
+    {
+        m_udpSocket->close();
+        m_udpSocket->deleteLater();
+        m_udpSocket = nullptr;
+    }
+    reconnectTimer(true);
+    m_udpOverruns = 0;
+    m_serverUid = "";
+    m_measurementInProgress = false;
+    m_scheduledAdjustments.clear();
+    timerOff(this, m_adjustmentTimer);
+}
+
+
+/// Lost the server while synchronized. The clock keeps running with the last disciplined
+/// frequency (software ppm or vctcxo dac) while the estimated error grows, see
+/// holdoverErrorBound_ns(). When the server comes back it is told so in the connect request
+/// and tracking resumes without a clock step, unless the error got too large meanwhile.
+///
+void Client::enterHoldover()
+{
+    trace->error("**** server connection lost, holdover ****");
+    closeServerConnection();
+    m_offsetMeasurementHistory.reset();
+
+    m_holdoverStart_ns = s_systemTime->getUpdatedSystemTime();
+    m_holdoverStartBound_ns = std::abs(m_lastServerOffset_ns);
+    m_holdoverReportCounter = 0;
+    setState(State::STATE_HOLDOVER);
+    timerOn(this, m_holdoverTimer, TIMER_1SEC);
+}
+
+
+/// Start from the frequency of the last run if it is recent and the temperature is about the
+/// same. In software mode the ppm is set right away, extrapolated with its trend over the
+/// downtime. A vctcxo has its frequency in default.dac already. The server is told about the
+/// warm start in the connect request and then skips most of the initial measurements.
+///
+void Client::loadDriftState()
+{
+    m_warmStart = false;
+    if (!m_persistDriftState)
+    {
+        return;
+    }
+
+    DriftState state = DriftState::load("client_" + m_id);
+    if (!state.m_valid)
+    {
+        return;
+    }
+
+    double age_hours = state.age_hours();
+    double temperature = localTemperature();
+    if (age_hours < 0.0 || age_hours > DRIFT_STATE_MAX_AGE_HOURS ||
+        std::fabs(temperature - state.m_temperature) > DRIFT_STATE_MAX_TEMPERATURE_DIFF)
+    {
+        trace->info("saved drift state not usable at {:.1f} °C, cold start", temperature);
+        return;
+    }
+
+    if (!VCTCXO_MODE)
+    {
+        double ppm = state.m_ppm + state.m_ppmTrend * std::min(age_hours, DRIFT_TREND_MAX_HOURS);
+        s_systemTime->setPPM(ppm);
+        trace->info("warm start with ppm {:.3f}", ppm);
+    }
+    m_driftState = state;
+    m_frequencyWander_ppm = state.m_wander_ppm;
+    m_warmStart = true;
+}
+
+
+/// Called periodically while synchronized. The ppm trend is the change since the last save,
+/// smoothed.
+///
+void Client::saveDriftState()
+{
+    DriftState state;
+    state.m_saved_ns = SystemTime::getWallClock_ns();
+    state.m_ppm = VCTCXO_MODE ? 0.0 : s_systemTime->getPPM();
+    state.m_wander_ppm = m_frequencyWander_ppm;
+    state.m_temperature = localTemperature();
+
+    if (m_driftState.m_valid)
+    {
+        double hours = (state.m_saved_ns - m_driftState.m_saved_ns) / NS_IN_SEC_F / 3600.0;
+        if (hours > 0.0)
+        {
+            double trend = (state.m_ppm - m_driftState.m_ppm) / hours;
+            state.m_ppmTrend = 0.8 * m_driftState.m_ppmTrend + 0.2 * trend;
+        }
+    }
+
+    if (state.save("client_" + m_id))
+    {
+        state.m_valid = true;
+        m_driftState = state;
+    }
+}
+
+
+double Client::localTemperature()
+{
+    if (VCTCXO_MODE)
+    {
+        return I2C_Access::I2C()->readTemperature();
+    }
+    return System::cpuTemperature();
+}
+
+
+/// The last known offset plus what the frequency could have wandered off since. The wander
+/// is estimated from the recent ppm adjustments from the servo.
+///
+int64_t Client::holdoverErrorBound_ns() const
+{
+    double holdover_sec = (s_systemTime->getUpdatedSystemTime() - m_holdoverStart_ns) / NS_IN_SEC_F;
+    double wander_ppm = std::max(m_frequencyWander_ppm, HOLDOVER_MIN_WANDER_PPM);
+    return m_holdoverStartBound_ns + (int64_t) (wander_ppm * 1000.0 * holdover_sec);
+}
+
+
+void Client::reconnectTimer(bool on)
+{
+    if (on)
+    {
+        if (m_tcpSocket.isOpen())
+        {
+            m_tcpSocket.close();
+        }
+
+        trace->info("contacting server");
+        timerOn(this, m_reconnectTimer, g_clientReconnectPeriod);
+        timerOff(this, m_serverPingTimer);
+        timerOff(this, m_clientPingTimer);
+    }
+    else
+    {
+        if (m_reconnectTimer == TIMEROFF)
+        {
+            trace->error("reconnect timer already inactive?");
+            return;
+        }
+        timerOff(this, m_reconnectTimer);
+        timerOn(this, m_serverPingTimer, g_serverPingTimeout);
+        timerOn(this, m_clientPingTimer, g_clientPingPeriod);
+    }
+}
+
+
+void Client::multicastRx(const MulticastRxPacket& rx)
+{
+    if (m_logLevel == spdlog::level::trace)
+    {
+        trace->trace("rx multicast: {}", rx.toString().toStdString());
+    }
+
+    if (m_connectionState == ConnectionState::CONNECTED)
+    {
+        if (rx.value("from") == "server" && rx.value("uid") != m_serverUid)
+        {
+            trace->warn("message from unknown server discarded");
+            return;
+        }
+    }
+
+    if (rx.value("from") == m_id || ((rx.value("to") != m_id && rx.value("to") != "all")))
+    {
+        return;
+    }
+
+    if (m_connectionState == ConnectionState::NOT_CONNECTED)
+    {
+        if (rx.value("command") == "serveraddress")
+        {
+            m_connectionState = ConnectionState::CONNECTING;
+            m_serverUid = rx.value("uid");
+            QHostAddress address(rx.value("tcpaddress"));
+            uint16_t port = rx.value("tcpport").toUShort();
+            startTcpClient(address, port);
+            reconnectTimer(false);
+        }
+        else if (rx.value("command") == "serverannounce")
+        {
+            trace->info("server announced, connecting");
+            sendServerConnectRequest();
+            timerOn(this, m_reconnectTimer, g_clientReconnectPeriod);
+        }
+    }
+    else if (m_connectionState == ConnectionState::CONNECTED)
+    {
+        m_serverAlive = true;
+    }
+
+    if (rx.value("command") == "control")
+    {
+        executeControl(rx);
+    }
+    else if (rx.value("command") == "peer" && m_peerLink)
+    {
+        m_peerLink->multicastRx(rx);
+    }
+    else if (rx.value("command") == "event" && rx.value("action") == "schedule")
+    {
+        m_eventScheduler->schedule(rx.value("name"), rx.value("at").toLongLong());
+    }
+}
+
+
+void Client::executeControl(const MulticastRxPacket& rx)
+{
+    std::string action = rx.value("action").toStdString();
+    trace->trace("got control command {}", action);
+
+    if (action == "kill")
+    {
+        trace->info("got kill, exiting..");
+        emit signalKill();
+    }
+    else if (action == "developmentmask")
+    {
+        g_developmentMask = rx.value("developmentmask").toInt();
+    }
+    else if (action == "shadow")
+    {
+        m_shadowFilters.setFilters(rx.value("value").toStdString());
+        m_shadowReportCounter = 0;
+    }
+    else if (action == "driftestimator")
+    {
+        OffsetMeasurementHistory::DriftEstimator driftEstimator;
+        if (OffsetMeasurementHistory::fromString(rx.value("value").toStdString(), driftEstimator))
+        {
+            m_offsetMeasurementHistory.setDriftEstimator(driftEstimator);
+        }
+        else
+        {
+            trace->error("unknown drift estimator '{}'", rx.value("value").toStdString());
+        }
+    }
+    else if (action == "kerneldiscipline")
+    {
+        setKernelDiscipline(rx.value("value") == "on");
+    }
+    else if (action == "vctcxodac")
+    {
+#ifdef VCTCXO
+        processVCTCXOcommand(rx);
+#else
+        trace->error("running in software mode, there is no dac here");
+#endif
+    }
+    else
+    {
+        trace->warn("control command not recognized, {}", action);
+    }
+}
+
+
+void Client::processVCTCXOcommand(const MulticastRxPacket& rx)
+{
+    QString value = rx.value("value");
+    if (value == "auto")
+    {
+        trace->info("setting vctcxo to auto");
+        I2C_Access::I2C()->setFixedVCTCXO_DAC(false);
+    }
+    else if (value == "get")
+    {
+        QJsonObject json;
+        json["from"] = m_id;
+        json["to"] = rx.value("from");
+        json["command"] = "metric";
+        json["action"] = "vctcxo_dac";
+        json["value"] = QString::number(I2C_Access::I2C()->getVCTCXO_DAC());
+        multicastTx(MulticastTxPacket(json));
+
+        trace->trace("sending vctcxo dac, {}={}", m_id.toStdString(), I2C_Access::I2C()->getVCTCXO_DAC());
+    }
+    else
+    {
+        uint16_t dac = value.toUShort();
+        I2C_Access::I2C()->writeVCTCXO_DAC(dac);
+        I2C_Access::I2C()->setFixedVCTCXO_DAC(true);
+        trace->info("setting vctcxo to fixed value {} (0x{:04x})", dac, dac);
+    }
+}
+
+
+void Client::multicastTx(MulticastTxPacket tx)
+{
+    m_multicast->tx(tx);
+}
+
+
+void Client::udpRx()
+{
+    int64_t localTime = s_systemTime->getUpdatedSystemTime();
+    int64_t remoteTime = *((int64_t*) m_udpSocket->receiveDatagram().data().data());
+
+    m_measurementSeries->add(remoteTime, localTime);
+
+    if (m_serverPingTimer != TIMEROFF)
+    {
+        m_serverAlive = true;
+    }
+
+    while (m_udpSocket->hasPendingDatagrams())
+    {
+        m_udpSocket->receiveDatagram();
+        m_udpOverruns++;
+    }
+
+    sendLocalTimeUDP();
+}
+
+
+void Client::tcpRx()
+{
+    m_serverAlive = true;
+
+    m_tcpReadBuffer += m_tcpSocket.readAll();
+
+    while(m_tcpReadBuffer.size() >= 2)
+    {
+        uint16_t length = *(const uint16_t*) m_tcpReadBuffer.constData();
+        if (m_tcpReadBuffer.size() < length + 2)
+        {
+            return;
+        }
+
+        QByteArray deserializedjson = m_tcpReadBuffer.mid(2, length);
+        m_tcpReadBuffer.remove(0, length + 2);
+        RxPacket rx(deserializedjson);
+
+        QString command = rx.value("command");
+
+        if (command == "sampleruncomplete")
+        {
+            m_measurementInProgress = false;
+            transmitClientReady();
+        }
+        else if (command == "running")
+        {
+            m_measurementInProgress = true;
+            m_expectedNofSamples = rx.value("samples").toInt();
+            if (!rx.value("filter").isEmpty())
+            {
+                // the server switches its filter for the same burst
+                m_measurementSeries->setFiltering(rx.value("filter").toStdString());
+                trace->info("sample filter is '{}'", rx.value("filter").toStdString());
+            }
+            if (rx.value("discard") == "1")
+            {
+                // the samples so far were a probe
+                m_measurementSeries->prepareNewDataMeasurement(m_expectedNofSamples);
+            }
+            else if (m_measurementSeries->getLocalTime().empty())
+            {
+                // prepared ahead when pipelined, update the sample count
+                m_measurementSeries->prepareNewDataMeasurement(m_expectedNofSamples);
+            }
+            m_measurementSeries->setWindow_ns(rx.value("window").toLongLong());
+            trace->debug("measurement started");
+        }
+        else if (command == "sendforwardoffset")
+        {
+            if (m_udpOverruns > 10)
+            {
+                trace->warn("discarded {} timesamples from udp overrun", m_udpOverruns);
+            }
+            m_udpOverruns = 0;
+
+            QJsonObject json;
+            json["command"] = "forwardoffset";
+            OffsetMeasurement offsetMeasurement = finalizeMeasurementRun();
+            json["offset"] = QString::number(offsetMeasurement.m_offset_ns);
+            json["valid"] = QString(OffsetMeasurement::ResultCodeAsString(offsetMeasurement.resultCode()).c_str());
+            json["outlier"] = offsetMeasurement.m_outlier ? "1" : "0";
+            if (rx.value("raw") == "1")
+            {
+                json["raw"] = RawTimestamps::encode(m_measurementSeries->getRemoteTime(),
+                                                    m_measurementSeries->getLocalTime());
+            }
+
+            // pipelined, i.e. declare readiness for the next burst right away
+            bool pipelined = rx.value("pipeline") == "1";
+            if (pipelined)
+            {
+                json["ready"] = "1";
+            }
+
+            trace->trace("send forwardoffset {} ns, result {}",
+                         offsetMeasurement.m_offset_ns,
+                         OffsetMeasurement::ResultCodeAsString(offsetMeasurement.resultCode()));
+            tcpTx(json);
+
+            if (pipelined)
+            {
+                m_measurementSeries->prepareNewDataMeasurement(m_expectedNofSamples);
+            }
+            m_measurementInProgress = false;
+        }
+        else if (command == "ping")
+        {
+        }
+        else if (command == "abort")
+        {
+            trace->info("burst aborted by server");
+            m_measurementInProgress = false;
+            m_udpOverruns = 0;
+            transmitClientReady();
+        }
+        else if (command == "adjustclock" || command == "adjustppm" ||
+                 command == "adjustwallclock" || command == "burstcomplete")
+        {
+            if (rx.value("at").isEmpty())
+            {
+                processAdjustment(rx);
+            }
+            else
+            {
+                // the effective time is in server time
+                scheduleAdjustment(rx.value("at").toLongLong() - rx.value("at_offset").toLongLong(),
+                                   deserializedjson);
+            }
+        }
+        else
+        {
+            trace->warn("noise on tcp socket '{}'", command.toStdString());
+        }
+    }
+}
+
+
+/// Clock and ppm adjustments from the server, either right away or at their effective time.
+///
+void Client::processAdjustment(const RxPacket& rx)
+{
+    QString command = rx.value("command");
+
+    if (!rx.value("at_offset").isEmpty())
+    {
+        m_lastServerOffset_ns = rx.value("at_offset").toLongLong();
+#ifndef VCTCXO
+        s_systemTime->setErrorBound_ns(std::abs(m_lastServerOffset_ns));
+#endif
+    }
+
+    if (command == "burstcomplete")
+    {
+        // pipelined, already ready for the next burst
+        if (!rx.value("ppm_adjust").isEmpty() && m_autoPPMAdjust)
+        {
+            serverAdjustPPM(rx.value("ppm_adjust").toDouble());
+        }
+    }
+    else if (command == "adjustclock")
+    {
+        if (m_noClockAdj)
+        {
+            trace->info("noclockadj, not setting system time");
+        }
+        else
+        {
+            int64_t epoc_ns = rx.value("adjust_ns").toLongLong();
+
+            if (epoc_ns)
+            {
+                trace->info(WHITE "adjusting clock with {} ns" RESET, epoc_ns);
+
+#ifdef CLIENT_USING_REALTIME
+                int64_t tt = s_systemTime->getWallClock() + epoc_ns;
+                struct timespec ts = {(__time_t) (tt / NS_IN_SEC), (__syscall_slong_t) (tt % NS_IN_SEC)};
+                clock_settime(CLOCK_REALTIME, &ts);
+#else
+                s_systemTime->adjustSystemTime_ns(epoc_ns);
+#endif
+            }
+            else
+            {
+                trace->info(WHITE "not adjusting clock" RESET);
+            }
+            QJsonObject json;
+            json["command"] = "clockadjusted";
+            tcpTx(json);
+
+            double local_ppm = m_offsetMeasurementHistory.getPPM();
+            //double server_ppm = rx.value("set_ppm").toDouble();
+
+            if (m_setInitialLocalPPM and m_autoPPMAdjust)
+            {
+                serverAdjustPPM(local_ppm);
+                m_setInitialLocalPPM = false;
+            }
+        }
+        if (VCTCXO_MODE)
+        {
+            int64_t wall_offset = rx.value("wall_clock").toLongLong();
+
+            s_systemTime->setWallclock_ns(s_systemTime->getRawSystemTime_ns() + wall_offset);
+            trace->info("adjusting wallclock to {}", SystemTime::getWallClock_ns());
+        }
+        m_offsetMeasurementHistory.reset();
+        m_measurementSeries->clearPool();
+    }
+    else if (command == "adjustppm")
+    {
+        if (m_autoPPMAdjust)
+        {
+            double ppm = rx.value("ppm_adjust").toDouble();
+            serverAdjustPPM(ppm);
+        }
+    }
+    else if (command == "adjustwallclock")
+    {
+        int64_t offset_ns = rx.value("offset_ns").toLongLong();
+        s_systemTime->setWallclock_ns(SystemTime::getWallClock_ns() - offset_ns);
+    }
+
+    m_eventScheduler->updateDeadlines();
+}
+
+
+/// Apply an adjustment when the local time reaches at_ns, see processScheduledAdjustments().
+///
+void Client::scheduleAdjustment(int64_t at_ns, const QByteArray& json)
+{
+    ScheduledAdjustment adjustment;
+    adjustment.m_at_ns = at_ns;
+    adjustment.m_json = json;
+
+    auto it = m_scheduledAdjustments.begin();
+    while (it != m_scheduledAdjustments.end() && it->m_at_ns <= at_ns)
+    {
+        ++it;
+    }
+    m_scheduledAdjustments.insert(it, adjustment);
+    startAdjustmentTimer();
+}
+
+
+void Client::startAdjustmentTimer()
+{
+    timerOff(this, m_adjustmentTimer);
+    if (m_scheduledAdjustments.empty())
+    {
+        return;
+    }
+    int64_t wait_ns = m_scheduledAdjustments.front().m_at_ns - s_systemTime->getUpdatedSystemTime() - adjustmentSpin_ns();
+    // without the spin wake up at or just after the effective time rather than ahead of it
+    int64_t wait_ms = (wait_ns + NS_IN_MSEC - 1) / NS_IN_MSEC;
+    m_adjustmentTimer = startTimer(std::max(wait_ms, (int64_t) 0), Qt::PreciseTimer);
+}
+
+
+/// The spin runs on the event loop which also timestamps the burst samples in udpRx(), so
+/// there is no spinning while a measurement is in progress. The adjustment is then applied
+/// when the timer fires, up to a millisecond late.
+///
+int64_t Client::adjustmentSpin_ns() const
+{
+    return m_measurementInProgress ? 0 : ADJUSTMENT_SPIN_NS;
+}
+
+
+/// The timer wakes up slightly ahead and the last part is spent spinning on the system time
+/// so that the adjustment is applied as close as possible to its effective time. How late it
+/// got applied, e.g. since the tcp message was late already, is reported back to the server.
+///
+void Client::processScheduledAdjustments()
+{
+    timerOff(this, m_adjustmentTimer);
+
+    while (!m_scheduledAdjustments.empty())
+    {
+        int64_t at_ns = m_scheduledAdjustments.front().m_at_ns;
+        int64_t now_ns = s_systemTime->getUpdatedSystemTime();
+        if (at_ns - now_ns > adjustmentSpin_ns())
+        {
+            break;
+        }
+        while (now_ns < at_ns)
+        {
+            now_ns = s_systemTime->getUpdatedSystemTime();
+        }
+
+        QByteArray json = m_scheduledAdjustments.front().m_json;
+        m_scheduledAdjustments.pop_front();
+        RxPacket rx(json);
+        processAdjustment(rx);
+
+        int64_t late_ns = now_ns - at_ns;
+        trace->debug("{} applied {:.1f} us late", rx.value("command").toStdString(), late_ns / 1000.0);
+
+        QJsonObject reply;
+        reply["command"] = "adjustapplied";
+        reply["adjustment"] = rx.value("command");
+        reply["late"] = QString::number(late_ns);
+        tcpTx(reply);
+    }
+    startAdjustmentTimer();
+}
+
+void Client::tcpTx(const QJsonObject &json)
+{
+    if (m_connectionState == ConnectionState::NOT_CONNECTED)
+    {
+        trace->warn("not connected, tcp tx ignored");
+        return;
+    }
+    TcpTxPacket tx(json);
+    m_tcpSocket.write(tx.getData());
+}
+
+
+void Client::tcpTx(const std::string& command)
+{
+    QJsonObject json;
+    json["command"] = QString::fromStdString(command);
+    tcpTx(json);
+}
+
+
+bool Client::locked()
+{
+    return m_lockCounter == LOCK_MAX;
+}
+
+
+/// A ppm adjustment measured by the server. Only these count towards the lock and make the
+/// client synchronized, a peer adjustment only sets the frequency, see slotPeerAdjustPPM().
+///
+void Client::serverAdjustPPM(double ppm)
+{
+    if (VCTCXO_MODE && m_autoPPMAdjust)
+    {
+        // Local detection of a stable time lock. A stable time lock is the criteria for
+        // saving a new updated default dac to file. Note that the server currently have
+        // a limit of relative ppm adjustments of +/- 0.1 as a protection against spurious
+        // bogus measurements.
+        if (std::fabs(ppm) < 0.08)
+        {
+            if( m_lockCounter != LOCK_MAX )
+            {
+                if (++m_lockCounter == LOCK_MAX)
+                {
+                    trace->info("hard lock entered");
+                }
+            }
+        }
+        else
+        {
+            if (m_lockCounter == LOCK_MAX)
+            {
+                trace->info("hard lock lost");
+            }
+            m_lockCounter = 0;
+        }
+    }
+
+    adjustPPM(ppm);
+
+    if (m_state == State::STATE_SYNCHRONIZED)
+    {
+        m_frequencyWander_ppm = 0.9 * m_frequencyWander_ppm + 0.1 * std::fabs(ppm);
+    }
+    setState(State::STATE_SYNCHRONIZED);
+}
+
+
+void Client::adjustPPM(double ppm)
+{
+    if (VCTCXO_MODE)
+    {
+        if (!m_autoPPMAdjust)
+        {
+            return;
+        }
+
+        // vctcxo "ASVTX-11-121-19.200MHz-T", nomimal +/-8ppm
+        const double lsb_per_ppm = 2600.0;
+
+        int64_t dac = I2C_Access::I2C()->getVCTCXO_DAC();
+
+        int new_dac = dac - ppm * lsb_per_ppm;
+
+        new_dac = qBound(0, new_dac, 0xFFFF);
+
+        if (new_dac == 0 || new_dac == 0xFFFF)
+        {
+            trace->critical("dac is saturated");
+        }
+
+        // not exactly a graceful way to adjust the dac
+        I2C_Access::I2C()->writeVCTCXO_DAC(new_dac);
+        trace->info("adjusted {:.6f} ppm. DAC adjusted {} from {} to {} lsb", ppm, new_dac - dac, dac, new_dac);
+    }
+    else // std
+    {
+        s_systemTime->setPPM(ppm);
+    }
+
+    if (m_measurementSeries)
+    {
+        m_measurementSeries->ppmAdjusted(ppm, s_systemTime->getUpdatedSystemTime());
+    }
+}
+
+
+void Client::connected()
+{
+    m_connectionState = ConnectionState::CONNECTED;
+    m_warmStart = false;
+    if (m_state != State::STATE_HOLDOVER)
+    {
+        setState(State::STATE_CONNECTED);
+    }
+    connect(&m_tcpSocket, &QTcpSocket::readyRead, this, &Client::tcpRx);
+
+    trace->info(IMPORTANT "connected, bind udp to local {}:{}" RESET,
+                m_tcpSocket.localAddress().toString().toStdString(),
+                m_tcpSocket.localPort());
+
+    m_udpSocket = new QUdpSocket(this);
+    m_udpSocket->bind(m_tcpSocket.localAddress(), m_tcpSocket.localPort());
+    connect(m_udpSocket, SIGNAL(readyRead()), this, SLOT(udpRx()));
+
+    tcpTx("ready");
+
+    if (m_peerLink)
+    {
+        QJsonObject json;
+        json["command"] = "peergroup";
+        json["peer"] = m_peerLink->peer();
+        tcpTx(json);
+    }
+
+    m_tcpSocket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+}
+
+
+void Client::timerEvent(QTimerEvent* timerEvent)
+{
+    int timerid = timerEvent->timerId();
+
+    if (timerid == m_SystemTimeRefreshTimer)
+    {
+#ifndef VCTCXO
+        if (!m_measurementInProgress)
+        {
+            s_systemTime->getUpdatedSystemTime();
+        }
+#endif
+    }
+    else if (timerid == m_adjustmentTimer)
+    {
+        processScheduledAdjustments();
+    }
+    else if (timerid == m_reconnectTimer)
+    {
+        sendServerConnectRequest();
+    }
+    else if (timerid == m_serverPingTimer)
+    {
+        if (m_serverAlive)
+        {
+            m_serverAlive = false;
+            return;
+        }
+        if (m_state == State::STATE_SYNCHRONIZED)
+        {
+            enterHoldover();
+        }
+        else
+        {
+            trace->error("**** server connection lost ****");
+            reset();
+        }
+    }
+    else if (timerid == m_holdoverTimer)
+    {
+        int64_t errorBound_ns = holdoverErrorBound_ns();
+#ifndef VCTCXO
+        s_systemTime->setErrorBound_ns(errorBound_ns);
+#endif
+        if (errorBound_ns > HOLDOVER_MAX_ERROR_NS)
+        {
+            trace->error("holdover error bound {:.1f} ms is too large, resetting", errorBound_ns / NS_IN_MSEC_F);
+            reset();
+        }
+        else if (++m_holdoverReportCounter % HOLDOVER_REPORT_PERIOD_SEC == 0)
+        {
+            trace->warn("holdover for {} secs, error bound {:.1f} us", m_holdoverReportCounter, errorBound_ns / 1000.0);
+        }
+    }
+    else if (timerid == m_clientPingTimer)
+    {
+        tcpTx("ping");
+    }
+    else if (timerid == m_saveDriftStateTimer)
+    {
+        if (m_state == State::STATE_SYNCHRONIZED)
+        {
+            saveDriftState();
+        }
+    }
+    else if (VCTCXO_MODE && timerid == m_saveNewDefaultDAC)
+    {
+        if (locked())
+        {
+            uint16_t dac = ((int) loadDefaultDAC() + I2C_Access::I2C()->getVCTCXO_DAC()) / 2;
+            saveDefaultDAC(dac);
+            killTimer(m_saveNewDefaultDAC);
+            m_saveNewDefaultDAC = TIMEROFF;
+        }
+    }
+    else
+    {
+        trace->warn("got unexpected timer event");
+    }
+}
+
+
+void Client::sendLocalTimeUDP()
+{
+    int64_t epoch = s_systemTime->getUpdatedSystemTime();
+    m_udpSocket->writeDatagram((const char *) &epoch, sizeof(int64_t), m_serverAddress, m_serverTcpPort);
+}
+
+
+void Client::sendServerConnectRequest()
+{
+    trace->trace("sending connection request");
+    QJsonObject json;
+    json["from"] = m_id;
+    json["to"] = "server";
+    json["command"] = "connect";
+    json["endpoint"] = Interface::getLocalAddress().toString();
+    if (m_state == State::STATE_HOLDOVER)
+    {
+        json["holdover"] = "1";
+    }
+    else if (m_warmStart)
+    {
+        json["warm"] = "1";
+    }
+    multicastTx(MulticastTxPacket(json));
+}
+
+
+void Client::startTcpClient(const QHostAddress &address, uint16_t port)
+{
+    trace->info("connecting, received server tcp socket address, connecting to {}:{}",
+                address.toString().toStdString(), port);
+    m_tcpSocket.connectToHost(address, port);
+    connect(&m_tcpSocket, &QTcpSocket::connected, this, &Client::connected, Qt::UniqueConnection);
+    m_serverAddress = address;
+    m_serverTcpPort = port;
+}
+
+
+OffsetMeasurement Client::finalizeMeasurementRun()
+{
+    m_measurementSeries->setDriftEstimate(m_offsetMeasurementHistory.getPPM());
+
+    FilterInput shadowInput;
+    if (m_shadowFilters.enabled())
+    {
+        shadowInput = m_measurementSeries->getFilterInput();
+    }
+
+    OffsetMeasurement summary = m_measurementSeries->calculate();
+
+    if (m_shadowFilters.enabled())
+    {
+        m_shadowFilters.evaluate(shadowInput, summary);
+        if (++m_shadowReportCounter % SHADOW_REPORT_PERIOD == 0)
+        {
+            trace->info("shadow: {}", m_shadowFilters.getReport());
+        }
+    }
+    if (summary.resultCode() == OffsetMeasurement::PASS)
+    {
+        if (m_offsetMeasurementHistory.add(summary))
+        {
+            trace->info(m_offsetMeasurementHistory.clientToString(I2C_Access::I2C()->getVCTCXO_DAC()));
+        }
+        else
+        {
+            summary.m_outlier = true;
+        }
+    }
+    else
+    {
+        trace->warn(RED "measurement discarded" RESET);
+    }
+
+    return summary;
+}
+
+
+void Client::transmitClientReady()
+{
+    m_measurementSeries->prepareNewDataMeasurement(m_expectedNofSamples);
+    tcpTx("ready");
+}
+
+
+/* Messages between server & client
+
+client               server
+                  <- Optional: running (probe)
+                  <- (sending time)
+(sending time) ->
+                  ...
+                  <- running
+                  <- (sending time)
+(sending time) ->
+                  ...
+              ...
+
+                  <- Optional: abort (congested burst)
+ready          ->
+
+                  <- sendforwardoffset
+forwardoffset ->     (with the raw timestamps if asked for)
+
+                  <- Optional: adjustclock
+clockadjusted ->
+
+                  <- sampleruncomplete
+ready          ->
+
+
+Pipelined, the default, where the client is ready for the next burst as soon as it has
+sent its forward offset and the ppm adjustment comes with the end of the burst:
+
+                  <- sendforwardoffset (pipeline)
+forwardoffset  ->    (ready)
+
+                  <- Optional: adjustclock
+clockadjusted ->
+
+                  <- burstcomplete (ppm adjustment)
+                  <- running, immediately or after the silence
+*/
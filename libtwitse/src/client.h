@@ -0,0 +1,171 @@
+#pragma once
+
+#include "basicoffsetmeasurement.h"
+#include "driftstate.h"
+#include "multicast.h"
+#include "offsetmeasurementhistory.h"
+#include "shadowfilters.h"
+
+#include "spdlog/common.h"
+#include <deque>
+#include <functional>
+#include <QTcpSocket>
+#include <QUdpSocket>
+
+class EventScheduler;
+class I2C_Access;
+class PeerLink;
+
+class Client : public QObject
+{
+    Q_OBJECT
+
+    enum ConnectionState
+    {
+        NOT_CONNECTED,
+        CONNECTING,
+        CONNECTED
+    };
+
+public:
+
+    /// The externally visible state, see Twitse::State.
+    enum State
+    {
+        STATE_DISCONNECTED,
+        STATE_CONNECTED,
+        STATE_SYNCHRONIZED,
+        STATE_HOLDOVER
+    };
+
+    Client(QObject *parent, const QString &name,
+           const QHostAddress &address, uint16_t port,
+           spdlog::level::level_enum loglevel,
+           bool clockadj, bool autoPPM_LSB, double fixedPPM_LSB);
+
+    ~Client();
+
+    void setPeer(const QString& peer, bool steer);
+    void setKernelDiscipline(bool enabled);
+    Q_INVOKABLE void scheduleEvent(const QString& name, qint64 at_ns);
+    void setEventCallback(std::function<void(const std::string& name, int64_t at_ns)> callback);
+    State state() const;
+
+signals:
+    void signalStateChanged(int state);
+    void signalKill();
+
+private:
+    void setState(State state);
+    void reset();
+    void closeServerConnection();
+    void enterHoldover();
+    int64_t holdoverErrorBound_ns() const;
+    void loadDriftState();
+    void saveDriftState();
+    static double localTemperature();
+    OffsetMeasurement finalizeMeasurementRun();
+
+    void sendServerConnectRequest();
+    void transmitClientReady();
+    void startTcpClient(const QHostAddress &address, uint16_t port);
+    void processVCTCXOcommand(const MulticastRxPacket& rx);
+    void multicastTx(MulticastTxPacket tx);
+    void tcpTx(const QJsonObject& json);
+    void tcpTx(const std::string& command);
+    bool locked();
+    void serverAdjustPPM(double ppm);
+    void adjustPPM(double ppm);
+
+    void reconnectTimer(bool on);
+    void sendLocalTimeUDP();
+    bool processIsTracking() const;
+    bool processIsLocked() const;
+    void executeControl(const MulticastRxPacket& rx);
+    void processAdjustment(const RxPacket& rx);
+    void scheduleAdjustment(int64_t at_ns, const QByteArray& json);
+    void startAdjustmentTimer();
+    void processScheduledAdjustments();
+    int64_t adjustmentSpin_ns() const;
+
+    void timerEvent(QTimerEvent *);
+
+private slots:
+    void connected();
+    void multicastRx(const MulticastRxPacket& rx);
+    void tcpRx();
+    void udpRx();
+    void slotPeerMulticastTx(const QJsonObject& json);
+    void slotPeerOffset(const QString& peer, int64_t offset_ns);
+    void slotPeerAdjustPPM(double ppm);
+    void slotEventFired(const QString& name, qint64 at_ns, qint64 late_ns);
+
+private:
+    QString m_id;
+    spdlog::level::level_enum m_logLevel;
+    bool m_autoPPMAdjust = true;
+    bool m_noClockAdj;
+    bool m_persistDriftState;
+    QString m_serverUid;
+
+    QThread* m_multicastThread;
+    Multicast* m_multicast = nullptr;
+    QTcpSocket m_tcpSocket;
+    QUdpSocket* m_udpSocket = nullptr;
+    QHostAddress m_serverAddress;
+    uint16_t m_serverTcpPort = 0;
+    QByteArray m_tcpReadBuffer;
+    int m_udpOverruns = 0;
+
+    int m_reconnectTimer = TIMEROFF;
+    int m_serverPingTimer = TIMEROFF;
+    int m_clientPingTimer = TIMEROFF;
+    int m_SystemTimeRefreshTimer = TIMEROFF;
+    int m_saveNewDefaultDAC = TIMEROFF;
+    int m_adjustmentTimer = TIMEROFF;
+    int m_holdoverTimer = TIMEROFF;
+    int m_saveDriftStateTimer = TIMEROFF;
+
+    struct ScheduledAdjustment
+    {
+        int64_t m_at_ns;
+        QByteArray m_json;
+    };
+    std::deque<ScheduledAdjustment> m_scheduledAdjustments;
+    const int64_t ADJUSTMENT_SPIN_NS = 2000000;
+
+    BasicMeasurementSeries* m_measurementSeries = nullptr;
+    OffsetMeasurementHistory m_offsetMeasurementHistory;
+    ShadowFilters m_shadowFilters;
+    PeerLink* m_peerLink = nullptr;
+    EventScheduler* m_eventScheduler = nullptr;
+    int m_shadowReportCounter = 0;
+    const int SHADOW_REPORT_PERIOD = 20;
+
+    ConnectionState m_connectionState = ConnectionState::NOT_CONNECTED;
+    State m_state = State::STATE_DISCONNECTED;
+    bool m_serverAlive = false;
+    bool m_setInitialLocalPPM = true;
+    bool m_measurementInProgress = false;
+    int m_expectedNofSamples = 0;
+
+    // holdover keeps the disciplined clock running when the server is lost
+    int64_t m_lastServerOffset_ns = 0;
+    double m_frequencyWander_ppm = 0.0;
+    int64_t m_holdoverStart_ns = 0;
+    int64_t m_holdoverStartBound_ns = 0;
+    int m_holdoverReportCounter = 0;
+    const double HOLDOVER_MIN_WANDER_PPM = 0.05;
+    const int64_t HOLDOVER_MAX_ERROR_NS = 10000000;
+    const int HOLDOVER_REPORT_PERIOD_SEC = 60;
+
+    // the frequency from the last run, see loadDriftState()
+    DriftState m_driftState;
+    bool m_warmStart = false;
+    const double DRIFT_STATE_MAX_AGE_HOURS = 7 * 24.0;
+    const double DRIFT_STATE_MAX_TEMPERATURE_DIFF = 10.0;
+    const double DRIFT_TREND_MAX_HOURS = 1.0;
+
+    int m_lockCounter = 0;
+    const int LOCK_MAX = 10;
+};
@@ -0,0 +1,169 @@
+#include "eventscheduler.h"
+#include "log.h"
+#include "globals.h"
+#include "systemtime.h"
+
+#include <chrono>
+#include <pthread.h>
+#include <time.h>
+
+
+EventScheduler::EventScheduler(QObject* parent)
+    : QObject(parent)
+{
+    m_thread = std::thread(&EventScheduler::run, this);
+
+    struct sched_param param;
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    if (pthread_setschedparam(m_thread.native_handle(), SCHED_FIFO, &param))
+    {
+        trace->warn("unable to set realtime priority for the event thread");
+    }
+}
+
+
+EventScheduler::~EventScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+
+/// Schedule the event 'name' at the server time at_ns. An event that is already due fires
+/// right away and is reported as late.
+///
+void EventScheduler::schedule(const QString& name, int64_t at_ns)
+{
+    Event event;
+    event.m_name = name.toStdString();
+    event.m_at_ns = at_ns;
+    event.m_deadline_ns = localDeadline_ns(at_ns);
+
+    trace->info("event '{}' scheduled in {:.3f} sec", event.m_name, (event.m_deadline_ns - localTime_ns()) / NS_IN_SEC_F);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        insert(event);
+    }
+    m_condition.notify_one();
+}
+
+
+/// Call when the local clock has been adjusted, i.e. when the relation between the local
+/// monotonic clock and the server time has changed.
+///
+void EventScheduler::updateDeadlines()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_events.empty())
+        {
+            return;
+        }
+        std::deque<Event> events;
+        events.swap(m_events);
+        for (Event& event : events)
+        {
+            event.m_deadline_ns = localDeadline_ns(event.m_at_ns);
+            insert(event);
+        }
+    }
+    m_condition.notify_one();
+}
+
+
+/// The callback is called from the event thread right at the deadline.
+///
+void EventScheduler::setFireCallback(FireCallback callback)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_callback = callback;
+}
+
+
+/// In the vctcxo build the synchronized time is the raw clock. In software mode the monotonic
+/// clock runs at the kernel rate, the same as the realtime clock but without steps.
+///
+int64_t EventScheduler::localTime_ns()
+{
+    struct timespec ts;
+#ifdef VCTCXO
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec * NS_IN_SEC + ts.tv_nsec;
+}
+
+
+/// Runs in the client thread since it uses the system time.
+///
+int64_t EventScheduler::localDeadline_ns(int64_t at_ns) const
+{
+    int64_t server_ns = s_systemTime->getUpdatedSystemTime();
+    int64_t local_ns = localTime_ns();
+    double rate = 1.0;
+#ifndef VCTCXO
+    // the synchronized time runs at the kernel rate corrected with the software ppm
+    if (!s_systemTime->kernelDiscipline())
+    {
+        rate = 1.0 / (1.0 - s_systemTime->getPPM() / 1000000.0);
+    }
+#endif
+    return local_ns + (int64_t) ((at_ns - server_ns) * rate);
+}
+
+
+void EventScheduler::insert(const Event& event)
+{
+    auto it = m_events.begin();
+    while (it != m_events.end() && it->m_deadline_ns <= event.m_deadline_ns)
+    {
+        ++it;
+    }
+    m_events.insert(it, event);
+}
+
+
+void EventScheduler::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_exit)
+    {
+        if (m_events.empty())
+        {
+            m_condition.wait(lock);
+            continue;
+        }
+
+        int64_t wait_ns = m_events.front().m_deadline_ns - localTime_ns() - SPIN_NS;
+        if (wait_ns > 0)
+        {
+            m_condition.wait_for(lock, std::chrono::nanoseconds(wait_ns));
+            continue;
+        }
+
+        Event event = m_events.front();
+        m_events.pop_front();
+        FireCallback callback = m_callback;
+        lock.unlock();
+
+        int64_t now_ns = localTime_ns();
+        while (now_ns < event.m_deadline_ns)
+        {
+            now_ns = localTime_ns();
+        }
+        if (callback)
+        {
+            callback(event.m_name, event.m_at_ns);
+        }
+        emit signalFired(QString::fromStdString(event.m_name), event.m_at_ns, now_ns - event.m_deadline_ns);
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QObject>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+/// Fires named events at a given server time, e.g. "all speakers start playing at T". The
+/// events are scheduled by the server or by any client on the multicast.
+///
+/// The server time is converted to a deadline on the local monotonic clock, so clock steps
+/// do not move it. The deadlines are recalculated with updateDeadlines() when the client
+/// adjusts its clock. A realtime thread sleeps until shortly before the deadline and
+/// busy-waits for the rest. signalFired() reports how late the event actually fired. It is
+/// emitted from the event thread.
+///
+class EventScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef std::function<void(const std::string& name, int64_t at_ns)> FireCallback;
+
+    EventScheduler(QObject* parent = nullptr);
+    ~EventScheduler();
+
+    void schedule(const QString& name, int64_t at_ns);
+    void updateDeadlines();
+    void setFireCallback(FireCallback callback);
+
+signals:
+    void signalFired(const QString& name, qint64 at_ns, qint64 late_ns);
+
+private:
+    struct Event
+    {
+        std::string m_name;
+        // server time
+        int64_t m_at_ns;
+        // local monotonic time
+        int64_t m_deadline_ns;
+    };
+
+    static int64_t localTime_ns();
+    int64_t localDeadline_ns(int64_t at_ns) const;
+    void insert(const Event& event);
+    void run();
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Event> m_events;
+    FireCallback m_callback;
+    bool m_exit = false;
+
+    // the last part before the deadline is spent busy-waiting
+    const int64_t SPIN_NS = 200000;
+};
@@ -0,0 +1,300 @@
+#include "peerlink.h"
+#include "log.h"
+#include "globals.h"
+#include "systemtime.h"
+#include "interface.h"
+#include "apputils.h"
+
+#include <QNetworkDatagram>
+#include <QTimerEvent>
+#include <QUdpSocket>
+
+
+PeerLink::PeerLink(QObject* parent, const QString& id, const QString& peer, bool steer)
+    : QObject(parent),
+      m_id(id),
+      m_peer(peer),
+      m_initiator(id < peer),
+      m_steer(steer),
+      m_measurementSeries(fmt::format("[peer {}] ", peer.toStdString()))
+{
+    m_udpSocket = new QUdpSocket(this);
+    m_udpSocket->bind(Interface::getLocalAddress(), 0);
+    connect(m_udpSocket, &QUdpSocket::readyRead, this, &PeerLink::slotUdpRx);
+
+    // only the responder steers, with both peers steering each would correct the full pair
+    // offset and the correction would be doubled
+    if (m_steer && m_initiator)
+    {
+        trace->error("'{}' is the peer link initiator and can't steer to '{}', only the responder steers",
+                     m_id.toStdString(), m_peer.toStdString());
+        m_steer = false;
+    }
+
+    if (m_steer)
+    {
+        // the frequency is owned by the server servo, without an integral here the two loops
+        // don't end up fighting over it
+        ServoParameters parameters;
+        parameters.ki = 0.0;
+        m_servo = ClockServo::create(ClockServo::PROPORTIONAL_INTEGRAL, fmt::format("[peer {}] ", peer.toStdString()), parameters);
+    }
+
+    trace->info("peer link to '{}' as {}{}, udp on {}:{}",
+                m_peer.toStdString(),
+                m_initiator ? "initiator" : "responder",
+                m_steer ? ", steering to peer" : "",
+                Interface::getLocalAddress().toString().toStdString(),
+                m_udpSocket->localPort());
+
+    timerOn(this, m_helloTimer, m_helloPeriod_ms);
+}
+
+
+PeerLink::~PeerLink()
+{
+    delete m_servo;
+}
+
+
+bool PeerLink::isInitiator() const
+{
+    return m_initiator;
+}
+
+
+const QString& PeerLink::peer() const
+{
+    return m_peer;
+}
+
+
+void PeerLink::sendHello(const QString& action)
+{
+    QJsonObject values;
+    values["endpoint"] = Interface::getLocalAddress().toString();
+    values["port"] = QString::number(m_udpSocket->localPort());
+    sendControl(action, values);
+}
+
+
+void PeerLink::sendControl(const QString& action, const QJsonObject& values)
+{
+    QJsonObject json = values;
+    json["from"] = m_id;
+    json["to"] = m_peer;
+    json["command"] = "peer";
+    json["action"] = action;
+    emit signalMulticastTx(json);
+}
+
+
+/// Messages from the peer on the multicast.
+///
+/// initiator        responder
+///    hello      ->
+///               <-  helloack
+///    start      ->
+///               <-  ready
+///    (udp time) ->
+///               <-  (udp time)
+///    ...
+///    collect    ->
+///               <-  offset
+///    result     ->
+///
+void PeerLink::multicastRx(const MulticastRxPacket& rx)
+{
+    if (rx.value("from") != m_peer)
+    {
+        return;
+    }
+
+    QString action = rx.value("action");
+
+    if (action == "hello" || action == "helloack")
+    {
+        bool known = m_peerPort != 0;
+        m_peerAddress = QHostAddress(rx.value("endpoint"));
+        m_peerPort = rx.value("port").toUShort();
+        if (!known)
+        {
+            trace->info("peer '{}' found at {}:{}", m_peer.toStdString(), m_peerAddress.toString().toStdString(), m_peerPort);
+        }
+        if (action == "hello")
+        {
+            sendHello("helloack");
+        }
+        if (m_initiator && !known)
+        {
+            timerOff(this, m_helloTimer);
+            timerOn(this, m_burstTimer, m_burstPeriod_ms);
+        }
+        else if (!m_initiator)
+        {
+            timerOff(this, m_helloTimer);
+        }
+    }
+    else if (action == "start" && !m_initiator)
+    {
+        m_measurementSeries.prepareNewDataMeasurement(rx.value("samples").toInt());
+        sendControl("ready");
+    }
+    else if (action == "ready" && m_initiator && m_burstActive)
+    {
+        m_samplesLeft = m_samples;
+        timerOn(this, m_sampleTimer, m_samplePeriod_ms);
+    }
+    else if (action == "collect" && !m_initiator)
+    {
+        OffsetMeasurement measurement = m_measurementSeries.calculate();
+        QJsonObject values;
+        values["offset"] = QString::number(measurement.m_offset_ns);
+        values["valid"] = measurement.resultCode() == OffsetMeasurement::PASS ? "1" : "0";
+        sendControl("offset", values);
+    }
+    else if (action == "offset" && m_initiator)
+    {
+        processPeerOffset(rx);
+    }
+    else if (action == "result" && !m_initiator)
+    {
+        int64_t offset_ns = rx.value("offset").toLongLong();
+        trace->info("peer offset to '{}' is {:.1f} us", m_peer.toStdString(), offset_ns / 1000.0);
+        // the initiator acts as the server so the offset is already as seen from here
+        steer(offset_ns);
+    }
+}
+
+
+void PeerLink::startBurst()
+{
+    if (m_burstActive)
+    {
+        trace->warn("peer '{}' did not complete the last burst", m_peer.toStdString());
+        timerOff(this, m_sampleTimer);
+    }
+    m_burstActive = true;
+    m_measurementSeries.prepareNewDataMeasurement(m_samples);
+
+    QJsonObject values;
+    values["samples"] = QString::number(m_samples);
+    sendControl("start", values);
+}
+
+
+void PeerLink::processPeerOffset(const MulticastRxPacket& rx)
+{
+    m_burstActive = false;
+
+    OffsetMeasurement measurement = m_measurementSeries.calculate();
+    if (rx.value("valid") != "1" || measurement.resultCode() != OffsetMeasurement::PASS)
+    {
+        trace->warn("peer measurement against '{}' discarded", m_peer.toStdString());
+        return;
+    }
+
+    // initiator2responder is measured by the responder
+    int64_t responder2initiator_ns = measurement.m_offset_ns;
+    int64_t initiator2responder_ns = rx.value("offset").toLongLong();
+    int64_t offset_ns = (responder2initiator_ns - initiator2responder_ns) / 2;
+    int64_t roundtrip_ns = responder2initiator_ns + initiator2responder_ns;
+
+    trace->info("peer offset of '{}' is {:.1f} us, roundtrip {:.1f} us",
+                m_peer.toStdString(), offset_ns / 1000.0, roundtrip_ns / 1000.0);
+
+    QJsonObject values;
+    values["offset"] = QString::number(offset_ns);
+    sendControl("result", values);
+
+    emit signalPeerOffset(m_peer, offset_ns);
+}
+
+
+/// Steer the local clock of the responder towards the peer. The server keeps steering the
+/// frequency as well, at a lower rate, so this is a proportional correction of the relative
+/// part only.
+///
+void PeerLink::steer(int64_t offset_ns)
+{
+    if (!m_servo)
+    {
+        return;
+    }
+
+    int64_t now_ns = s_systemTime->getUpdatedSystemTime();
+    if (m_previousOffsetTime_ns)
+    {
+        ServoInput input;
+        input.offset_us = offset_ns / 1000.0;
+        input.previousOffset_us = m_previousOffset_ns / 1000.0;
+        input.deltaTime_sec = (now_ns - m_previousOffsetTime_ns) / NS_IN_SEC_F;
+        emit signalAdjustPPM(m_servo->adjust(input));
+    }
+    m_previousOffset_ns = offset_ns;
+    m_previousOffsetTime_ns = now_ns;
+}
+
+
+void PeerLink::sendLocalTime()
+{
+    int64_t epoch = s_systemTime->getUpdatedSystemTime();
+    m_udpSocket->writeDatagram((const char *) &epoch, sizeof(int64_t), m_peerAddress, m_peerPort);
+}
+
+
+void PeerLink::slotUdpRx()
+{
+    int64_t localTime = s_systemTime->getUpdatedSystemTime();
+    QNetworkDatagram datagram = m_udpSocket->receiveDatagram();
+    if (datagram.data().size() != sizeof(int64_t))
+    {
+        return;
+    }
+    int64_t remoteTime = *((const int64_t*) datagram.data().constData());
+
+    m_measurementSeries.add(remoteTime, localTime);
+
+    while (m_udpSocket->hasPendingDatagrams())
+    {
+        m_udpSocket->receiveDatagram();
+    }
+
+    // the responder echoes every sample
+    if (!m_initiator)
+    {
+        sendLocalTime();
+    }
+}
+
+
+void PeerLink::timerEvent(QTimerEvent* event)
+{
+    int timerid = event->timerId();
+
+    if (timerid == m_helloTimer)
+    {
+        sendHello("hello");
+    }
+    else if (timerid == m_burstTimer)
+    {
+        startBurst();
+    }
+    else if (timerid == m_sampleTimer)
+    {
+        if (m_samplesLeft-- > 0)
+        {
+            sendLocalTime();
+        }
+        else
+        {
+            timerOff(this, m_sampleTimer);
+            timerOn(this, m_collectTimer, m_collectDelay_ms);
+        }
+    }
+    else if (timerid == m_collectTimer)
+    {
+        timerOff(this, m_collectTimer);
+        sendControl("collect");
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "basicoffsetmeasurement.h"
+#include "clockservo.h"
+#include "rxpacket.h"
+
+#include <QObject>
+#include <QHostAddress>
+#include <QJsonObject>
+
+class QUdpSocket;
+class QTimerEvent;
+
+
+/// Direct measurements between two clients in a group, e.g. the two speakers in a stereo pair.
+/// The client with the lowest name is the initiator and runs two-way bursts against the other
+/// client over a dedicated udp echo path, exactly as the server does against a client. The
+/// control messages between the peers goes on the multicast. The resulting pair offset uses the
+/// same sign convention as the server offsets with the initiator acting as the server.
+/// Steering to the peer is only done by the responder.
+///
+class PeerLink : public QObject
+{
+    Q_OBJECT
+
+public:
+    PeerLink(QObject* parent, const QString& id, const QString& peer, bool steer);
+    ~PeerLink();
+
+    void multicastRx(const MulticastRxPacket& rx);
+    bool isInitiator() const;
+    const QString& peer() const;
+
+signals:
+    void signalMulticastTx(const QJsonObject& json);
+    void signalPeerOffset(const QString& peer, int64_t offset_ns);
+    void signalAdjustPPM(double ppm);
+
+private slots:
+    void slotUdpRx();
+
+private:
+    void timerEvent(QTimerEvent* event) override;
+    void sendHello(const QString& action);
+    void sendControl(const QString& action, const QJsonObject& values = QJsonObject());
+    void sendLocalTime();
+    void startBurst();
+    void processPeerOffset(const MulticastRxPacket& rx);
+    void steer(int64_t offset_ns);
+
+    QString m_id;
+    QString m_peer;
+    bool m_initiator;
+    bool m_steer;
+
+    QUdpSocket* m_udpSocket = nullptr;
+    QHostAddress m_peerAddress;
+    uint16_t m_peerPort = 0;
+
+    BasicMeasurementSeries m_measurementSeries;
+    ClockServo* m_servo = nullptr;
+    int64_t m_previousOffset_ns = 0;
+    int64_t m_previousOffsetTime_ns = 0;
+
+    int m_helloTimer = TIMEROFF;
+    int m_burstTimer = TIMEROFF;
+    int m_sampleTimer = TIMEROFF;
+    int m_collectTimer = TIMEROFF;
+    int m_samplesLeft = 0;
+    bool m_burstActive = false;
+
+    const int m_helloPeriod_ms = 2000;
+    const int m_burstPeriod_ms = 10000;
+    const int m_samplePeriod_ms = 10;
+    const int m_samples = 100;
+    const int m_collectDelay_ms = 100;
+};
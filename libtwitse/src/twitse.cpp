@@ -0,0 +1,340 @@
+#include "twitse.h"
+#include "client.h"
+#include "log.h"
+#include "globals.h"
+#include "systemtime.h"
+#include "timepage.h"
+
+#include <QCoreApplication>
+#include <QThread>
+#include <atomic>
+#include <future>
+#include <thread>
+
+static std::atomic<bool> s_clientRunning(false);
+
+
+static spdlog::level::level_enum logLevel(int level)
+{
+    switch (level)
+    {
+    case 0 : return spdlog::level::err;
+    case 2 : return spdlog::level::debug;
+    case 3 : return spdlog::level::trace;
+    default : break;
+    }
+    return spdlog::level::info;
+}
+
+
+class Twitse::Private
+{
+public:
+    void createClient();
+    void destroyClient();
+    void setState(State state);
+
+    Options m_options;
+    StateCallback m_callback;
+    EventCallback m_eventCallback;
+    std::atomic<int> m_state{STOPPED};
+
+    // without a QCoreApplication in the process the client runs in a std::thread with its own
+    std::thread m_thread;
+    QCoreApplication* m_application = nullptr;
+    // with an existing QCoreApplication the client runs in a QThread
+    QThread* m_qthread = nullptr;
+
+    Client* m_client = nullptr;
+    TimePageReader m_timePage;
+};
+
+
+/// Runs in the client thread.
+///
+void Twitse::Private::createClient()
+{
+    QHostAddress address(m_options.m_multicastIp.empty() ? g_multicastIp : m_options.m_multicastIp.c_str());
+    uint16_t port = m_options.m_port ? m_options.m_port : g_multicastPort;
+
+    spdlog::level::level_enum loglevel = logLevel(m_options.m_logLevel);
+
+    trace->info("libtwitse client '{}' on multicast {}:{}", m_options.m_id, address.toString().toStdString(), port);
+
+    m_client = new Client(nullptr, QString::fromStdString(m_options.m_id), address, port, loglevel,
+                          m_options.m_noClockAdjust, !m_options.m_useFixedAdjust, m_options.m_fixedAdjust);
+
+#ifndef VCTCXO
+    s_systemTime->openTimePage(m_options.m_sharedTimePage);
+    m_timePage.attach(s_systemTime->getTimePage());
+    if (m_options.m_kernelDiscipline)
+    {
+        m_client->setKernelDiscipline(true);
+    }
+#endif
+
+    if (!m_options.m_peer.empty())
+    {
+        m_client->setPeer(QString::fromStdString(m_options.m_peer), m_options.m_peerSteer);
+    }
+
+    m_client->setEventCallback(m_eventCallback);
+
+    QObject::connect(m_client, &Client::signalStateChanged, [this](int state)
+    {
+        switch (state)
+        {
+        case Client::State::STATE_CONNECTED : setState(CONNECTED); break;
+        case Client::State::STATE_SYNCHRONIZED : setState(SYNCHRONIZED); break;
+        case Client::State::STATE_HOLDOVER : setState(HOLDOVER); break;
+        default : setState(DISCONNECTED); break;
+        }
+    });
+
+    // a kill from the control application stops the client, not the application
+    QObject::connect(m_client, &Client::signalKill, [this]()
+    {
+        if (m_application)
+        {
+            QCoreApplication::quit();
+        }
+        else
+        {
+            m_qthread->quit();
+        }
+    });
+
+    setState(DISCONNECTED);
+}
+
+
+/// Runs in the client thread when its event loop has ended.
+///
+void Twitse::Private::destroyClient()
+{
+    m_timePage.close();
+    delete m_client;
+    m_client = nullptr;
+    setState(STOPPED);
+}
+
+
+void Twitse::Private::setState(State state)
+{
+    if (m_state.exchange(state) != state)
+    {
+        trace->info("libtwitse state is {}", stateName(state));
+        if (m_callback)
+        {
+            m_callback(state);
+        }
+    }
+}
+
+
+Twitse::Twitse()
+    : m_private(new Private)
+{
+}
+
+
+Twitse::~Twitse()
+{
+    stop();
+}
+
+
+/// Start the client, false if a client is already running in this process.
+///
+bool Twitse::start(const Options& options, StateCallback callback)
+{
+    // an application that set up trace itself also decides its log level
+    if (!trace)
+    {
+        trace = options.m_logger ? options.m_logger : Twitse::logger();
+        trace->set_level(logLevel(options.m_logLevel));
+    }
+
+    if (options.m_id.empty())
+    {
+        trace->critical("libtwitse needs a unique client name");
+        return false;
+    }
+    if (s_clientRunning.exchange(true))
+    {
+        trace->error("libtwitse only supports a single client per process");
+        return false;
+    }
+
+    m_private->m_options = options;
+    m_private->m_callback = callback;
+
+    std::promise<void> created;
+    Private* p = m_private.get();
+
+    if (QCoreApplication::instance())
+    {
+        m_private->m_qthread = new QThread;
+        QObject::connect(m_private->m_qthread, &QThread::started, [p, &created]()
+        {
+            p->createClient();
+            created.set_value();
+        });
+        QObject::connect(m_private->m_qthread, &QThread::finished, [p]()
+        {
+            p->destroyClient();
+        });
+        m_private->m_qthread->start();
+    }
+    else
+    {
+        m_private->m_thread = std::thread([p, &created]()
+        {
+            static int argc = 1;
+            static char name[] = "libtwitse";
+            static char* argv[] = {name, nullptr};
+            QCoreApplication application(argc, argv);
+            p->m_application = &application;
+            p->createClient();
+            created.set_value();
+            QCoreApplication::exec();
+            p->destroyClient();
+            p->m_application = nullptr;
+        });
+    }
+
+    created.get_future().wait();
+    return true;
+}
+
+
+void Twitse::stop()
+{
+    if (m_private->m_qthread)
+    {
+        m_private->m_qthread->quit();
+        m_private->m_qthread->wait();
+        delete m_private->m_qthread;
+        m_private->m_qthread = nullptr;
+        s_clientRunning = false;
+    }
+    else if (m_private->m_thread.joinable())
+    {
+        QCoreApplication* application = m_private->m_application;
+        if (application)
+        {
+            QMetaObject::invokeMethod(application, "quit", Qt::QueuedConnection);
+        }
+        m_private->m_thread.join();
+        s_clientRunning = false;
+    }
+}
+
+
+Twitse::State Twitse::state() const
+{
+    return static_cast<State>(m_private->m_state.load());
+}
+
+
+bool Twitse::synchronized() const
+{
+    return state() == SYNCHRONIZED;
+}
+
+
+/// The current server time as estimated locally. Before the client is synchronized this is
+/// just the local time, in holdover it is the free running estimate.
+///
+int64_t Twitse::nowServer_ns() const
+{
+#ifdef VCTCXO
+    // the local clock is steered by the oscillator and is the server time as it is
+    return s_systemTime ? s_systemTime->getUpdatedSystemTime() : 0;
+#else
+    int64_t time_ns;
+    if (m_private->m_timePage.serverTime_ns(time_ns))
+    {
+        return time_ns;
+    }
+    return SystemTime::getWallClock_ns();
+#endif
+}
+
+
+/// The current ppm correction of the software time model, i.e. the ppm in the time page.
+/// It is 0.0 in the vctcxo build where the oscillator itself is adjusted, and with kernel
+/// discipline where the kernel runs CLOCK_REALTIME at the corrected rate instead.
+///
+double Twitse::ppm() const
+{
+#ifdef VCTCXO
+    return 0.0;
+#else
+    TimePageSnapshot snapshot;
+    if (m_private->m_timePage.read(snapshot))
+    {
+        return snapshot.m_ppm;
+    }
+    return 0.0;
+#endif
+}
+
+
+/// Fire the event 'name' on all clients, including this one, at the server time at_ns.
+///
+void Twitse::scheduleEvent(const std::string& name, int64_t at_ns)
+{
+    if (!m_private->m_client)
+    {
+        if (!trace)
+        {
+            trace = Twitse::logger();
+        }
+        trace->error("libtwitse is not running, event '{}' ignored", name);
+        return;
+    }
+    QMetaObject::invokeMethod(m_private->m_client, "scheduleEvent", Qt::QueuedConnection,
+                              Q_ARG(QString, QString::fromStdString(name)), Q_ARG(qint64, at_ns));
+}
+
+
+/// Set before start() or while running.
+///
+void Twitse::setEventCallback(EventCallback callback)
+{
+    m_private->m_eventCallback = callback;
+    if (m_private->m_client)
+    {
+        m_private->m_client->setEventCallback(callback);
+    }
+}
+
+
+const char* Twitse::stateName(State state)
+{
+    switch (state)
+    {
+    case STOPPED : return "stopped";
+    case DISCONNECTED : return "disconnected";
+    case CONNECTED : return "connected";
+    case SYNCHRONIZED : return "synchronized";
+    case HOLDOVER : return "holdover";
+    }
+    return "unknown";
+}
+
+
+/// The "twitse" spdlog logger, created the first time it is asked for unless the application
+/// already registered a logger with that name.
+///
+std::shared_ptr<spdlog::logger> Twitse::logger()
+{
+    std::shared_ptr<spdlog::logger> logger = spdlog::get("twitse");
+    if (!logger)
+    {
+        logger = spdlog::stdout_color_mt("twitse");
+        logger->set_pattern(logformat);
+    }
+    return logger;
+}
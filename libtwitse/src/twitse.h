@@ -0,0 +1,99 @@
+#pragma once
+
+// The public api of libtwitse. This header only uses the standard library so that it can be
+// included by applications that are not Qt based themselves.
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace spdlog
+{
+class logger;
+}
+
+
+/// An in process twitse client. The client runs the same protocol, measurements and servo as
+/// the twitse_client executable, in a thread of its own. If the application already has a
+/// QCoreApplication the client runs in a QThread, otherwise the thread gets its own
+/// QCoreApplication.
+///
+/// The client disciplines the process local time exactly as the executable does and will as
+/// such also adjust the system clock unless m_noClockAdjust is set. There can only be a single
+/// client running in a process at any time.
+///
+/// nowServer_ns(), ppm(), state(), synchronized() and scheduleEvent() can be called from any
+/// thread between start() and stop(). The state callback is called from the client thread.
+/// The event callback is called from a realtime thread right when an event fires, at the
+/// same server time on all clients. It should return quickly.
+///
+/// The library doesn't define any globals. Like the twitse executables the application defines
+/// 'std::shared_ptr<spdlog::logger> trace', 'int g_developmentMask' and 'SystemTime*
+/// s_systemTime', see util/src/log.h and util/src/systemtime.h. It leaves s_systemTime to the
+/// client, which creates it on start() and deletes it on stop(), and may leave trace empty. An empty trace is set to m_logger, or to a spdlog logger named
+/// "twitse" that is created if the application hasn't registered one itself.
+///
+class Twitse
+{
+public:
+    enum State
+    {
+        STOPPED,
+        DISCONNECTED,
+        CONNECTED,
+        SYNCHRONIZED,
+        // lost the server, the clock runs on with the last synchronized frequency
+        HOLDOVER
+    };
+
+    typedef std::function<void(State state)> StateCallback;
+    typedef std::function<void(const std::string& name, int64_t at_ns)> EventCallback;
+
+    struct Options
+    {
+        std::string m_id;
+        // empty for the default multicast group
+        std::string m_multicastIp;
+        // 0 for the default multicast port
+        uint16_t m_port = 0;
+        bool m_noClockAdjust = false;
+        // run with a fixed ppm (software build) or dac value (vctcxo build) instead of the servo
+        bool m_useFixedAdjust = false;
+        double m_fixedAdjust = 0.0;
+        // run direct measurements against this client, see PeerLink
+        std::string m_peer;
+        // steer the clock towards the peer, only for the client with the highest name in the pair
+        bool m_peerSteer = false;
+        // also publish the time page for other processes, see timepage.h
+        bool m_sharedTimePage = false;
+        // let the kernel run CLOCK_REALTIME at the corrected rate, software build only
+        bool m_kernelDiscipline = false;
+        // 0:error 1:info 2:debug 3:all
+        int m_logLevel = 1;
+        // used when the application hasn't set up trace, see logger()
+        std::shared_ptr<spdlog::logger> m_logger;
+    };
+
+    Twitse();
+    ~Twitse();
+
+    bool start(const Options& options, StateCallback callback = nullptr);
+    void stop();
+
+    State state() const;
+    bool synchronized() const;
+    int64_t nowServer_ns() const;
+    // the software time model correction, 0.0 with kernel discipline, see twitse.cpp
+    double ppm() const;
+
+    void scheduleEvent(const std::string& name, int64_t at_ns);
+    void setEventCallback(EventCallback callback);
+
+    static const char* stateName(State state);
+    static std::shared_ptr<spdlog::logger> logger();
+
+private:
+    class Private;
+    std::unique_ptr<Private> m_private;
+};
@@ -0,0 +1,63 @@
+#include "commonmode.h"
+#include "log.h"
+
+#include <algorithm>
+#include <vector>
+
+
+/// Record the residual of a burst, i.e. the device offset minus its own running average,
+/// and return the common mode in us that should be subtracted from the device offset.
+///
+double CommonModeEstimator::update(const QString& device, int64_t start_ns, int64_t end_ns, double residual_us)
+{
+    std::vector<double> concurrent;
+    for (auto it = m_devices.constBegin(); it != m_devices.constEnd(); ++it)
+    {
+        if (it.key() != device && it->m_start_ns <= end_ns && it->m_end_ns >= start_ns)
+        {
+            concurrent.push_back(it->m_residual_us);
+        }
+    }
+
+    DeviceState& state = m_devices[device];
+    state.m_start_ns = start_ns;
+    state.m_end_ns = end_ns;
+    state.m_residual_us = residual_us;
+
+    if (concurrent.empty())
+    {
+        return 0.0;
+    }
+
+    std::nth_element(concurrent.begin(), concurrent.begin() + concurrent.size() / 2, concurrent.end());
+    double commonMode_us = concurrent[concurrent.size() / 2];
+
+    state.m_covariance += m_forgetting * (residual_us * commonMode_us - state.m_covariance);
+    state.m_variance += m_forgetting * (commonMode_us * commonMode_us - state.m_variance);
+    state.m_count++;
+
+    double gain = getGain(device);
+    trace->debug("[{:<8}] common mode {:.1f} us from {} devices, gain {:.2f}",
+                 device.toStdString(), commonMode_us, concurrent.size(), gain);
+
+    return gain * commonMode_us;
+}
+
+
+void CommonModeEstimator::removeDevice(const QString& device)
+{
+    m_devices.remove(device);
+}
+
+
+/// The regression gain of the device residual on the common mode, clipped to 0..1.
+///
+double CommonModeEstimator::getGain(const QString& device) const
+{
+    auto it = m_devices.constFind(device);
+    if (it == m_devices.constEnd() || it->m_count < m_warmup || it->m_variance <= 0.0)
+    {
+        return 0.0;
+    }
+    return std::max(0.0, std::min(it->m_covariance / it->m_variance, 1.0));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QMap>
+#include <QString>
+
+#include <stdint.h>
+
+
+/// All clients share the server send path and clock so a server side scheduling hiccup
+/// shows up as a correlated offset error on every device measuring at the same time.
+/// The common mode for a device is the median residual of the other devices whose bursts
+/// overlapped its own. It is scaled with a per device regression gain so that it is only
+/// subtracted to the extent it actually correlates with the device residuals.
+///
+class CommonModeEstimator
+{
+public:
+    double update(const QString& device, int64_t start_ns, int64_t end_ns, double residual_us);
+    void removeDevice(const QString& device);
+    double getGain(const QString& device) const;
+
+private:
+    struct DeviceState
+    {
+        int64_t m_start_ns = 0;
+        int64_t m_end_ns = 0;
+        double m_residual_us = 0.0;
+        double m_covariance = 0.0;
+        double m_variance = 0.0;
+        int m_count = 0;
+    };
+
+    QMap<QString, DeviceState> m_devices;
+
+    const double m_forgetting = 0.05;
+    const int m_warmup = 10;
+};
@@ -8,13 +8,20 @@
 #include "offsetmeasurementhistory.h"
 #include "apputils.h"
 #include "datafiles.h"
+#include "shadowfilters.h"
+#include "filterselector.h"
+#include "commonmode.h"
+#include "jointoffset.h"
+#include "rawtimestamps.h"
 
 #include <cmath>
+#include <limits>
 #include <QObject>
 #include <QTimerEvent>
 #include <QNetworkDatagram>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QJsonArray>
 
 
 extern int g_developmentMask;
@@ -28,6 +35,7 @@ Device::Device(QObject* parent, const QString& clientName)
       m_lock(clientName.toStdString())
 {
     m_offsetMeasurementHistory = new OffsetMeasurementHistory;
+    m_connectTime_sec = s_systemTime->getRunningTime_secs();
     if (!m_server->listen())
     {
         trace->critical("{}unable to start device server", getLogName());
@@ -35,6 +43,9 @@ Device::Device(QObject* parent, const QString& clientName)
     }
 
     m_measurementSeries = new BasicMeasurementSeries(getLogName());
+    m_servo = ClockServo::create(ClockServo::DEFAULT, getLogName());
+    m_shadowFilters = new ShadowFilters(getLogName());
+    m_filterSelector = new FilterSelector(getLogName(), m_measurementSeries->getFilterName());
     m_serverAddress = Interface::getLocalAddress().toString();
     m_clientUdpPort = m_server->serverPort();
     trace->info("{}bind udp to local {}:{}", getLogName(), m_serverAddress.toStdString(), m_clientUdpPort);
@@ -69,6 +80,9 @@ Device::~Device()
     m_udp->deleteLater();
 
     delete m_offsetMeasurementHistory;
+    delete m_servo;
+    delete m_shadowFilters;
+    delete m_filterSelector;
 }
 
 
@@ -87,6 +101,10 @@ void Device::sendServerTimeUDP()
     m_udp->writeDatagram((const char *) &epoch, sizeof(int64_t), m_clientAddress, m_clientTcpPort);
     m_clientPingCounter = g_serverPingPeriod / 500;
     m_statusReport.packetSentOrReceived();
+
+    m_burstSent++;
+    m_blockSent++;
+    monitorBurst();
 }
 
 
@@ -98,8 +116,28 @@ void Device::processTimeSample(int64_t remoteTime, int64_t localTime)
 
 void Device::processMeasurement(const RxPacket& rx)
 {
+    m_measurementSeries->setDriftEstimate(m_offsetMeasurementHistory->getPPM());
+
+    FilterInput shadowInput;
+    if (m_shadowFilters->enabled() || m_filterSelector->enabled())
+    {
+        shadowInput = m_measurementSeries->getFilterInput();
+    }
+
     OffsetMeasurement measurement = m_measurementSeries->calculate();
 
+    if (m_shadowFilters->enabled())
+    {
+        m_shadowFilters->evaluate(shadowInput, measurement);
+        sendShadowFilterStats();
+    }
+
+    std::string selectedFilter = m_filterSelector->update(shadowInput, measurement);
+    if (!selectedFilter.empty())
+    {
+        switchFilter(selectedFilter);
+    }
+
     trace->debug("{}{}", getLogName(), measurement.toString());
 
     int64_t server2client_ns = rx.value("offset").toLongLong();
@@ -114,6 +152,34 @@ void Device::processMeasurement(const RxPacket& rx)
     // the central offset from a measurement series
     int64_t clientoffset_ns = (client2server_ns - server2client_ns) / 2;
 
+    // or from the matched packet pairs if the client sent its raw timestamps
+    if (m_jointOffset && !rx.value("raw").isEmpty())
+    {
+        SampleList64 serverSent, clientReceived;
+        if (RawTimestamps::decode(rx.value("raw"), serverSent, clientReceived))
+        {
+            JointOffsetResult joint = JointOffset::calculate(serverSent, clientReceived,
+                                                             m_measurementSeries->getRemoteTime(),
+                                                             m_measurementSeries->getLocalTime(),
+                                                             m_offsetMeasurementHistory->getPPM());
+            trace->debug("{}{}, independent offset {:.3f} us",
+                         getLogName(), joint.toString(), clientoffset_ns / 1000.0);
+            m_jointPairs = joint.m_usedPairs;
+            if (joint.m_valid)
+            {
+                m_jointOffsetDiff_us = (joint.m_offset_ns - clientoffset_ns) / 1000.0;
+                clientoffset_ns = joint.m_offset_ns;
+                roundtrip_ns = joint.m_roundtrip_ns;
+                roundtrip_us = roundtrip_ns / 1000.0;
+                roundtrip_ms = roundtrip_us / 1000.0;
+            }
+        }
+        else
+        {
+            trace->warn("{}unable to decode the raw client timestamps", getLogName());
+        }
+    }
+
     // save some potentially troublesome measurements on an otherwise stable system
     // for later analysis.
     if (m_saveOddMeasurements and
@@ -133,6 +199,8 @@ void Device::processMeasurement(const RxPacket& rx)
         }
     }
 
+    m_lastClientOffset_ns = clientoffset_ns;
+
     if (m_fixedSamplePeriod_ms > 0)
     {
         clientoffset_ns = 0;
@@ -147,12 +215,17 @@ void Device::processMeasurement(const RxPacket& rx)
                     fmt::format("sample_period_sweep_{}", name()), m_fixedSamplePeriod_ms);
     }
 
-    m_statusReport.newMeasurement(m_lock.getNofSamples(),
+    m_statusReport.newMeasurement(burstSamples(),
                                   measurement.m_collectedSamples,
                                   measurement.m_usedSamples);
 
     measurement.setOffset_ns(clientoffset_ns);
-    m_offsetMeasurementHistory->add(measurement);
+    bool outlier = !m_offsetMeasurementHistory->add(measurement);
+    if (rx.value("outlier") == "1")
+    {
+        trace->warn("{}client flagged its measurement as an outlier", getLogName());
+        outlier = true;
+    }
 
     // initial guards for sanity. If any one fails then give up.
 
@@ -184,20 +257,57 @@ void Device::processMeasurement(const RxPacket& rx)
     if (!valid && (m_fixedSamplePeriod_ms < 0))
     {
         sampleRunComplete();
-        m_lock.panic();
+        if (!outlier)
+        {
+            m_lock.panic();
+        }
         return;
     }
 
     double clientoffset_us = clientoffset_ns / 1000.0;
 
+    if (m_holdoverResume)
+    {
+        m_holdoverResume = false;
+        if (std::abs(clientoffset_ns) > HOLDOVER_STEP_LIMIT_NS)
+        {
+            trace->warn("{}offset {:.1f} us after holdover, reinitializing", getLogName(), clientoffset_us);
+            m_initState = InitState::PPM_MEASUREMENTS;
+            m_initStateCounter = initialPPMMeasurements();
+        }
+        else
+        {
+            trace->info("{}resuming after holdover with offset {:.1f} us", getLogName(), clientoffset_us);
+        }
+    }
+
     if (m_initState == InitState::RUNNING)
     {
+        // the offset is for the middle of the burst, on the wall clock as used by the websocket
+        int64_t burstTime_ms = SystemTime::getWallClock_ns() / NS_IN_MSEC;
+        if (measurement.m_endtime_ns)
+        {
+            int64_t burstMiddle_ns = measurement.m_starttime_ns + (measurement.m_endtime_ns - measurement.m_starttime_ns) / 2;
+            burstTime_ms -= (s_systemTime->getUpdatedSystemTime() - burstMiddle_ns) / NS_IN_MSEC;
+        }
         emit signalNewOffsetMeasurement(m_name,
+                                        burstTime_ms,
                                         clientoffset_us,
                                         m_offsetMeasurementHistory->getMeanAbsoluteDeviation_us(),
                                         m_offsetMeasurementHistory->getSD_us());
     }
 
+    // the part of the offset shared with the other devices measuring at the same time is
+    // removed before the lock and the servo sees it.
+    double commonMode_us = 0.0;
+    if (m_commonMode && !outlier && m_initState == InitState::RUNNING && m_averagesInitialized)
+    {
+        commonMode_us = m_commonMode->update(m_name,
+                                             measurement.m_starttime_ns,
+                                             measurement.m_endtime_ns,
+                                             clientoffset_us - m_avgClientOffset_ns);
+    }
+
     if (!m_averagesInitialized)
     {
         m_avgClientOffset_ns = clientoffset_us;
@@ -205,70 +315,47 @@ void Device::processMeasurement(const RxPacket& rx)
         m_averagesInitialized = true;
         m_previousClientOffset_ns = m_avgClientOffset_ns;
     }
-    else
+    else if (!outlier)
     {
         m_avgClientOffset_ns = 0.9 * m_avgClientOffset_ns + 0.1 * clientoffset_us;
         m_avgRoundtrip_us = 0.9 * m_avgRoundtrip_us + 0.1 * roundtrip_us;
     }
 
-    if (m_initState == InitState::RUNNING && m_offsetMeasurementHistory->size() > 1)
+    // an outlier is kept away from the lock and the servo
+    if (!outlier && m_initState == InitState::RUNNING && m_offsetMeasurementHistory->size() > 1)
     {
-        // experimental constants galore.
-#ifdef VCTCXO
-        double magicnumber_zero = 330;
-        const double magicnumber_antislope = 9;
-        const double magicnumber_hilock_throttle = 1.25;
-        const double magicnumber_lock_throttle = 1.25;
-#else
-        double magicnumber_zero = 400;
-        const double magicnumber_antislope = 500000;
-        const double magicnumber_hilock_throttle = 4;
-        const double magicnumber_lock_throttle = 2;
-#endif
-        bool zero_crossing = clientoffset_us * m_previousClientOffset_ns < 0.0;
-        if (!zero_crossing and abs(clientoffset_us) < abs(m_previousClientOffset_ns))
-        {
-            magicnumber_zero *= 4;
-        }
-
-        double offset_ppm = - clientoffset_us / magicnumber_zero;
+        m_lock.update(clientoffset_us - commonMode_us);
 
-        double deltatime = m_offsetMeasurementHistory->getLastTimespan_sec();
-        double levelling_ppm = - (clientoffset_us - m_previousClientOffset_ns) / (deltatime * magicnumber_antislope);
+        ServoInput servoInput;
+        servoInput.offset_us = clientoffset_us - commonMode_us;
+        servoInput.previousOffset_us = m_previousClientOffset_ns;
+        // the previous correction only acted from when it was applied
+        servoInput.deltaTime_sec = std::max(m_offsetMeasurementHistory->getLastTimespan_sec() - m_adjustmentDelay_sec, 0.0);
+        m_adjustmentDelay_sec = 0.0;
+        servoInput.locked = m_lock.isLock();
+        servoInput.hiLocked = m_lock.isHiLock();
 
-        double ppm = offset_ppm + levelling_ppm;
+        double ppm = m_servo->adjust(servoInput);
 
-        m_lock.update(clientoffset_us);
-
-        if (m_lock.isHiLock())
-        {
-            ppm /= magicnumber_hilock_throttle;
-        }
-        else if (m_lock.isLock())
+        if (m_lock.isHiLock() && ++m_driftStateCounter % DRIFT_STATE_SAVE_PERIOD == 0)
         {
-            ppm /= magicnumber_lock_throttle;
+            saveDriftState();
         }
 
-        trace->debug("{}adjusting ppm {:7.3f} (offset {:7.3f} levelling {:7.3f})",
-                     getLogName(), ppm, offset_ppm, levelling_ppm);
-
-        double ppmLimit = 0.2;
-        if (m_lock.isLock())
+        if (m_clientReady)
         {
-            ppmLimit = 0.1;
+            m_burstCompleteReply["ppm_adjust"] = QString::number(ppm);
+            setEffectiveTime(m_burstCompleteReply);
         }
-
-        if (std::fabs(ppm) > ppmLimit)
+        else
         {
-            double newppm = ppm >= ppmLimit ? ppmLimit : -ppmLimit;
-            trace->warn("{}large ppm adjustment value {} truncated to {}", getLogName(), ppm, newppm);
-            ppm = newppm;
+            QJsonObject json;
+            json["command"] = "adjustppm";
+            json["ppm_adjust"] = QString::number(ppm);
+            setEffectiveTime(json);
+            tcpTx(json);
         }
-
-        QJsonObject json;
-        json["command"] = "adjustppm";
-        json["ppm_adjust"] = QString::number(ppm);
-        tcpTx(json);
+        m_measurementSeries->ppmAdjusted(ppm, m_adjustmentEffective_ns);
     }
 
     std::string extra = m_initState != RUNNING ? " (wait)" : "";
@@ -277,8 +364,18 @@ void Device::processMeasurement(const RxPacket& rx)
     {
         extra += OffsetMeasurement::ResultCodeAsString(measurement.resultCode());
     }
-
-    m_previousClientOffset_ns = clientoffset_us;
+    if (commonMode_us != 0.0)
+    {
+        extra += fmt::format(" common mode {:.1f}", commonMode_us);
+    }
+    if (outlier)
+    {
+        extra += " outlier";
+    }
+    else
+    {
+        m_previousClientOffset_ns = clientoffset_us - commonMode_us;
+    }
 
     double average_offset = m_initState == InitState::RUNNING ? m_avgClientOffset_ns : 0.0;
 
@@ -322,7 +419,9 @@ void Device::processMeasurement(const RxPacket& rx)
 
     if (m_initState == InitState::CLIENT_CONFIGURING)
     {
-        int64_t client_adjustment_ns = (int64_t) client2server_ns - roundtrip_ns / 2;
+        // the measured offset, which is the joint offset if enabled. Taken before the
+        // development sample period sweep zeroes it.
+        int64_t client_adjustment_ns = m_lastClientOffset_ns;
 
         m_averagesInitialized = false;
 
@@ -330,10 +429,13 @@ void Device::processMeasurement(const RxPacket& rx)
         json["command"] = "adjustclock";
         double ppm = m_offsetMeasurementHistory->getPPM();
 
-        int64_t future_ns = 0.5 * ppm * 1000.0 * m_offsetMeasurementHistory->getLastTimespan_sec();
+        // including the drift until the effective time
+        int64_t future_ns = ppm * 1000.0 * (0.5 * m_offsetMeasurementHistory->getLastTimespan_sec() +
+                                            ADJUSTMENT_LEAD_NS / NS_IN_SEC_F);
 
         json["adjust_ns"] = QString::number(client_adjustment_ns + future_ns);
         json["set_ppm"] = QString::number(-ppm);
+        setEffectiveTime(json);
 
         if (VCTCXO_MODE)
         {
@@ -352,6 +454,12 @@ void Device::processMeasurement(const RxPacket& rx)
                     getLogName(), client_adjustment_ns, ppm);
 
         m_offsetMeasurementHistory->reset();
+        m_measurementSeries->clearPool();
+        m_servo->reset();
+        if (m_warmStart)
+        {
+            restoreDriftState();
+        }
         m_initState = InitState::RUNNING;
     }
     else
@@ -366,6 +474,7 @@ void Device::processMeasurement(const RxPacket& rx)
             m_lock.setFixedSamplePeriod_ms(3);
             Lock::setFixedMeasurementSilence_sec(0);
             Lock::setFixedClientSamples(500);
+            m_filterSelector->setEnabled(false);
             m_measurementSeries->setFiltering(MeasurementSeriesBase::EVERYTHING);
             m_fixedSamplePeriod_ms = 3;
         }
@@ -411,6 +520,16 @@ void Device::timerEvent(QTimerEvent* event)
 
         measurementStart();
     }
+    else if (id == m_mainBurstTimer)
+    {
+        timerOff(this, m_mainBurstTimer);
+        startSampleRun(m_mainBurstSamples, true);
+    }
+    else if (id == m_abortBurstTimer)
+    {
+        timerOff(this, m_abortBurstTimer);
+        abortBurst();
+    }
 }
 
 
@@ -492,33 +611,15 @@ void Device::slotTcpRx()
 
         if (command == "ready")
         {
-            int delay_sec = m_lock.getInterMeasurementDelaySecs();
-
-            if (m_measurementCollisionNotice)
-            {
-                m_measurementCollisionNotice = false;
-                if (delay_sec > 10)
-                {
-                    trace->info("measurement collision {}, offsetting next measurement", name());
-                }
-                delay_sec -= 2;
-            }
-
-            if (delay_sec <= 0 )
-            {
-                measurementStart();
-            }
-            else
-            {
-                timerOn(this, m_sampleRunTimer, delay_sec * 1000);
-            }
-
+            scheduleNextBurst();
         }
         else if (command == "ping")
         {
         }
         else if (command == "forwardoffset")
         {
+            // a pipelining client is already prepared for the next burst
+            m_clientReady = rx.value("ready") == "1";
             std::string result = rx.value("valid").toStdString();
             bool clientValid = result == OffsetMeasurement::ResultCodeAsString(OffsetMeasurement::PASS);
             if (!clientValid)
@@ -533,10 +634,28 @@ void Device::slotTcpRx()
             }
 
         }
+        else if (command == "adjustapplied")
+        {
+            processAdjustmentApplied(rx);
+        }
+        else if (command == "eventfired")
+        {
+            processEventFired(rx);
+        }
         else if (command == "clockadjusted")
         {
             sampleRunComplete();
         }
+        else if (command == "peergroup")
+        {
+            m_peer = rx.value("peer");
+            trace->info("{}in peer group with '{}', measuring at a lower rate", getLogName(), m_peer.toStdString());
+            m_lock.setSilenceFactor(PEER_GROUP_SILENCE_FACTOR);
+        }
+        else if (command == "peeroffset")
+        {
+            processPeerOffset(rx);
+        }
         else
         {
             accepted = false;
@@ -568,6 +687,10 @@ void Device::slotUdpRx()
     processTimeSample(clientTime, localTime);
     m_statusReport.packetSentOrReceived();
 
+    int64_t delay_ns = localTime - clientTime;
+    m_burstFloor_ns = std::min(m_burstFloor_ns, delay_ns);
+    m_blockDelays.push_back(delay_ns);
+
     while (m_udp->hasPendingDatagrams())
     {
         m_udp->receiveDatagram();
@@ -579,6 +702,18 @@ void Device::slotUdpRx()
 
 void Device::slotNewLockState(Lock::LockState lockState)
 {
+    double elapsed_sec = s_systemTime->getRunningTime_secs() - m_connectTime_sec;
+    if (lockState != Lock::UNLOCKED && m_timeToLock_sec < 0.0)
+    {
+        m_timeToLock_sec = elapsed_sec;
+        trace->info("{}time to lock {:.1f} secs", getLogName(), m_timeToLock_sec);
+    }
+    if (lockState == Lock::HILOCK && m_timeToHiLock_sec < 0.0)
+    {
+        m_timeToHiLock_sec = elapsed_sec;
+        trace->info("{}time to high lock {:.1f} secs", getLogName(), m_timeToHiLock_sec);
+    }
+
     QJsonObject json;
     json["name"] = m_name;
     json["command"] = "lockstateupdate";
@@ -589,7 +724,17 @@ void Device::slotNewLockState(Lock::LockState lockState)
 
 void Device::getClientOffset()
 {
-    tcpTx("sendforwardoffset");
+    QJsonObject json;
+    json["command"] = "sendforwardoffset";
+    if (m_jointOffset)
+    {
+        json["raw"] = "1";
+    }
+    if (m_pipelined)
+    {
+        json["pipeline"] = "1";
+    }
+    tcpTx(json);
 }
 
 
@@ -597,6 +742,53 @@ std::string Device::getStatusReport()
 {
     std::string ret = fmt::format("{} {}", name(), m_statusReport.getReport());
     ret += fmt::format(" mean.abs.dev.us={:.3f}", m_offsetMeasurementHistory->getMeanAbsoluteDeviation_us());
+    ret += fmt::format(" outliers={}", m_offsetMeasurementHistory->getOutliers());
+    ret += fmt::format(" {}", m_filterSelector->getReport());
+    if (m_timeToLock_sec >= 0.0)
+    {
+        ret += fmt::format(" time.to.lock.sec={:.1f}", m_timeToLock_sec);
+    }
+    if (m_timeToHiLock_sec >= 0.0)
+    {
+        ret += fmt::format(" time.to.hilock.sec={:.1f}", m_timeToHiLock_sec);
+    }
+    if (m_commonMode)
+    {
+        ret += fmt::format(" common.mode.gain={:.2f}", m_commonMode->getGain(m_name));
+    }
+    if (!m_peer.isEmpty())
+    {
+        ret += fmt::format(" peer={} peer.offset.us={:.1f}", m_peer.toStdString(), m_peerOffset_us);
+    }
+    if (m_maxAdjustmentLate_us > 0.0)
+    {
+        ret += fmt::format(" adjust.late.us={:.1f} adjust.late.max.us={:.1f}", m_adjustmentLate_us, m_maxAdjustmentLate_us);
+        m_maxAdjustmentLate_us = 0.0;
+    }
+    if (m_eventsFired)
+    {
+        ret += fmt::format(" events={} event.error.max.us={:.1f}", m_eventsFired, m_maxEventError_us);
+        m_eventsFired = 0;
+        m_maxEventError_us = 0.0;
+    }
+    if (m_burstAborts)
+    {
+        ret += fmt::format(" burst.aborts={}", m_burstAborts);
+        m_burstAborts = 0;
+    }
+    if (m_probeBursts)
+    {
+        ret += fmt::format(" probe.spread.us={:.1f} probe.postponed={}", m_probeSpread_ns / 1000.0, m_probesPostponed);
+        m_probesPostponed = 0;
+    }
+    if (m_jointOffset)
+    {
+        ret += fmt::format(" joint.pairs={} joint.diff.us={:.3f}", m_jointPairs, m_jointOffsetDiff_us);
+    }
+    if (m_shadowFilters->enabled())
+    {
+        ret += fmt::format("\n      {}shadow: {}", getLogName(), m_shadowFilters->getReport());
+    }
     m_statusReport = StatusReport();
     return ret;
 }
@@ -618,23 +810,269 @@ void Device::measurementCollisionNotice()
 
 void Device::measurementStart()
 {
-    int count = m_lock.getNofSamples();
+    if (m_probeBursts && m_fixedSamplePeriod_ms < 0 && !acquiring())
+    {
+        m_burstStage = BurstStage::PROBE;
+        startSampleRun(PROBE_SAMPLES, false);
+    }
+    else
+    {
+        m_burstStage = BurstStage::MEASURE;
+        m_measurementSeries->setWindow_ns(0);
+        startSampleRun(burstSamples(), false);
+    }
+}
 
+
+/// With discard the client drops the samples it got so far, i.e. the probe, and uses the
+/// filter window sized from the probe.
+///
+void Device::startSampleRun(int count, bool discard)
+{
     QJsonObject json;
     json["command"] = "running";
     json["samples"] = QString::number(count);
+    if (!m_pendingFilter.empty())
+    {
+        m_measurementSeries->setFiltering(m_pendingFilter);
+        json["filter"] = QString::fromStdString(m_pendingFilter);
+        m_pendingFilter.clear();
+    }
+    if (discard)
+    {
+        json["discard"] = "1";
+        json["window"] = QString::number(m_probeWindow_ns);
+    }
     tcpTx(json);
 
-    trace->debug("{}starting sample run with {} samples and period_ms {} (slept {} secs)",
-                 getLogName(), count, m_lock.getSamplePeriod_ms(), m_lock.getInterMeasurementDelaySecs());
-    emit signalRequestSamples(this, count, m_lock.getSamplePeriod_ms());
+    m_burstAborted = false;
+    m_burstSent = 0;
+    m_blockSent = 0;
+    m_congestedBlocks = 0;
+    m_burstFloor_ns = std::numeric_limits<int64_t>::max();
+    m_blockDelays.clear();
+
+    trace->debug("{}starting {} with {} samples and period_ms {} (slept {} secs)",
+                 getLogName(), m_burstStage == BurstStage::PROBE ? "probe" : "sample run",
+                 count, burstSamplePeriod_ms(), m_lock.getInterMeasurementDelaySecs());
+    emit signalRequestSamples(this, count, burstSamplePeriod_ms());
+}
+
+
+/// Called when the server has sent all the samples in a sample run.
+///
+void Device::sampleRunEnded()
+{
+    if (m_burstAborted)
+    {
+        m_measurementSeries->prepareNewDataMeasurement(burstSamples());
+        tcpTx("abort");
+    }
+    else if (m_burstStage == BurstStage::PROBE)
+    {
+        processProbe();
+    }
+    else
+    {
+        SampleList64 delay = MathFunc::diff(m_measurementSeries->getLocalTime(), m_measurementSeries->getRemoteTime());
+        if (!delay.empty())
+        {
+            double spread_ns = MathFunc::median(delay) - MathFunc::min(delay);
+            m_burstSpreadBaseline_ns = m_burstSpreadBaseline_ns == 0.0 ?
+                        spread_ns : 0.9 * m_burstSpreadBaseline_ns + 0.1 * spread_ns;
+        }
+        m_burstBackoff_sec = 0;
+        getClientOffset();
+    }
+}
+
+
+/// Watch the burst while it runs, in blocks of samples sent. A block with heavy loss or with
+/// its median delay inflated far above the burst floor compared to the usual burst spread is
+/// congested, and a burst with consecutive congested blocks would only be thrown away by the
+/// filter. It is then aborted right away and the lock state is left alone.
+///
+void Device::monitorBurst()
+{
+    if (!m_burstAbort || m_burstAborted || m_burstStage != BurstStage::MEASURE ||
+        m_fixedSamplePeriod_ms > 0 || m_blockSent < ABORT_BLOCK_SAMPLES)
+    {
+        return;
+    }
+
+    double loss = 1.0 - std::min((int) m_blockDelays.size(), m_blockSent) / (double) m_blockSent;
+    int64_t inflation_ns = m_blockDelays.empty() ? 0 : MathFunc::median(m_blockDelays) - m_burstFloor_ns;
+
+    bool congested = loss > ABORT_LOSS ||
+            (m_burstSpreadBaseline_ns > 0.0 &&
+             inflation_ns > ABORT_MIN_INFLATION_NS &&
+             inflation_ns > ABORT_INFLATION_FACTOR * m_burstSpreadBaseline_ns);
+
+    m_congestedBlocks = congested ? m_congestedBlocks + 1 : 0;
+    m_blockSent = 0;
+    m_blockDelays.clear();
+
+    if (m_congestedBlocks >= ABORT_BLOCKS)
+    {
+        trace->warn("{}aborting burst after {} samples, loss {:.0f}% and delay inflation {:.1f} us against a spread of {:.1f} us",
+                    getLogName(), m_burstSent, loss * 100.0, inflation_ns / 1000.0, m_burstSpreadBaseline_ns / 1000.0);
+        m_burstAborted = true;
+        m_burstAborts++;
+        m_burstBackoff_sec = m_burstBackoff_sec ?
+                    std::min(2 * m_burstBackoff_sec, ABORT_MAX_BACKOFF_SEC) : ABORT_MIN_BACKOFF_SEC;
+        // the sample scheduler is calling this
+        timerOn(this, m_abortBurstTimer, 0);
+    }
+}
+
+
+/// Cancels the sample run after which the client is told with 'abort', and the next burst is
+/// scheduled after an exponential backoff.
+///
+void Device::abortBurst()
+{
+    emit signalCancelSamples(m_name);
 }
 
 
+/// A short probe ahead of the burst gives the delay floor and spread of the channel right
+/// now. The spread sizes the burst and its filter window. A spread far above the baseline
+/// from the previous probes, or heavy loss, means that the channel is congested and the
+/// burst is postponed. This happens at most a few times in a row after which a lasting
+/// change simply becomes the new baseline.
+///
+void Device::processProbe()
+{
+    SampleList64 delay = MathFunc::diff(m_measurementSeries->getLocalTime(), m_measurementSeries->getRemoteTime());
+    bool lossy = (int) delay.size() < PROBE_SAMPLES / 2;
+    int64_t floor_ns = 0;
+    m_probeSpread_ns = 0.0;
+    if (!lossy)
+    {
+        floor_ns = MathFunc::min(delay);
+        m_probeSpread_ns = MathFunc::median(delay) - floor_ns;
+    }
+
+    bool congested = lossy ||
+            (m_probeSpreadBaseline_ns > 0.0 && m_probeSpread_ns > PROBE_CONGESTION_FACTOR * m_probeSpreadBaseline_ns);
+
+    if (congested && m_probePostponements < PROBE_MAX_POSTPONEMENTS)
+    {
+        trace->info("{}probe spread {:.1f} us against baseline {:.1f} us{}, postponing measurement",
+                    getLogName(), m_probeSpread_ns / 1000.0, m_probeSpreadBaseline_ns / 1000.0,
+                    lossy ? fmt::format(" and only {} of {} samples", delay.size(), PROBE_SAMPLES) : "");
+        m_probePostponements++;
+        m_probesPostponed++;
+        m_probePostponed = true;
+        sampleRunComplete();
+        return;
+    }
+
+    int samples = m_lock.getNofSamples();
+    int64_t window_ns = 0;
+
+    if (!lossy)
+    {
+        if (m_probeSpreadBaseline_ns > 0.0 && !m_lock.hasFixedNofSamples())
+        {
+            int scaled = samples * m_probeSpread_ns / m_probeSpreadBaseline_ns;
+            samples = std::max(samples / 2, std::min(scaled, std::min(2 * samples, m_lock.getMaxNofSamples())));
+        }
+        window_ns = std::max(PROBE_MIN_WINDOW_NS,
+                             std::min((int64_t) (PROBE_WINDOW_FACTOR * m_probeSpread_ns), PROBE_MAX_WINDOW_NS));
+
+        if (congested || m_probeSpreadBaseline_ns == 0.0)
+        {
+            m_probeSpreadBaseline_ns = m_probeSpread_ns;
+        }
+        else
+        {
+            m_probeSpreadBaseline_ns = 0.9 * m_probeSpreadBaseline_ns + 0.1 * m_probeSpread_ns;
+        }
+    }
+
+    trace->debug("{}probe floor {} ns, spread {:.1f} us, measuring with {} samples and window {} us",
+                 getLogName(), floor_ns, m_probeSpread_ns / 1000.0, samples, window_ns / 1000);
+
+    m_probePostponements = 0;
+    m_burstStage = BurstStage::MEASURE;
+    m_measurementSeries->prepareNewDataMeasurement(samples);
+    m_measurementSeries->setWindow_ns(window_ns);
+    m_mainBurstSamples = samples;
+    m_probeWindow_ns = window_ns;
+
+    // the sample scheduler is still busy with the probe
+    timerOn(this, m_mainBurstTimer, 0);
+}
+
+
+/// If the client declared itself ready in its forward offset then whatever is pending for it,
+/// i.e. a ppm adjustment, goes in a single 'burstcomplete' and the next burst is scheduled
+/// right away. Otherwise the client is told with 'sampleruncomplete' and answers with 'ready'.
+///
 void Device::sampleRunComplete()
 {
-    m_measurementSeries->prepareNewDataMeasurement(m_lock.getNofSamples());
-    tcpTx("sampleruncomplete");
+    m_measurementSeries->prepareNewDataMeasurement(burstSamples());
+
+    if (m_clientReady)
+    {
+        m_clientReady = false;
+        QJsonObject json = m_burstCompleteReply;
+        json["command"] = "burstcomplete";
+        tcpTx(json);
+        m_burstCompleteReply = QJsonObject();
+        scheduleNextBurst();
+    }
+    else
+    {
+        tcpTx("sampleruncomplete");
+    }
+}
+
+
+void Device::scheduleNextBurst()
+{
+    int delay_sec = acquiring() ? 0 : m_lock.getInterMeasurementDelaySecs();
+    if (m_probePostponed)
+    {
+        m_probePostponed = false;
+        delay_sec = PROBE_RETRY_SEC;
+    }
+    else if (m_burstAborted)
+    {
+        m_burstAborted = false;
+        delay_sec = m_burstBackoff_sec;
+        trace->info("{}burst aborted, next in {} secs", getLogName(), delay_sec);
+    }
+
+    if (m_measurementCollisionNotice)
+    {
+        m_measurementCollisionNotice = false;
+        if (delay_sec > 10)
+        {
+            trace->info("measurement collision {}, offsetting next measurement", name());
+        }
+        delay_sec -= 2;
+    }
+
+    // an adjustment that hasn't taken effect on the client yet would otherwise land in the
+    // middle of the burst and the detrend and drift fit would straddle the step
+    int64_t pending_ns = m_adjustmentEffective_ns + std::max(0.0, m_adjustmentLate_us) * 1000 -
+                         s_systemTime->getUpdatedSystemTime();
+    int delay_ms = delay_sec * 1000;
+    if (pending_ns > 0)
+    {
+        delay_ms = std::max(delay_ms, (int) (pending_ns / NS_IN_MSEC) + 1);
+    }
+
+    if (delay_ms <= 0)
+    {
+        measurementStart();
+    }
+    else
+    {
+        timerOn(this, m_sampleRunTimer, delay_ms);
+    }
 }
 
 
@@ -650,6 +1088,321 @@ std::string Device::name() const
 }
 
 
+/// Replace the clock servo, e.g. from the control application. The new servo gets the given
+/// parameters and takes over the correction of the old one, so the client frequency doesn't jump.
+///
+void Device::setServo(ClockServo::ServoType servoType, const ServoParameters& parameters)
+{
+    // the new servo continues from the correction the client already runs with
+    double output_ppm = m_servo ? m_servo->output_ppm() : 0.0;
+    delete m_servo;
+    m_servo = ClockServo::create(servoType, getLogName(), parameters);
+    m_servo->setOutput_ppm(output_ppm);
+    trace->info("{}servo parameters {}", getLogName(), parameters.toString());
+}
+
+
+void Device::setServoParameters(const ServoParameters& parameters)
+{
+    m_servo->setParameters(parameters);
+    trace->info("{}servo parameters {}", getLogName(), parameters.toString());
+}
+
+
+const ClockServo* Device::servo() const
+{
+    return m_servo;
+}
+
+
+/// A manually selected filter stops the automatic filter selection, 'auto' starts it again.
+///
+bool Device::setFilter(const std::string& filterName)
+{
+    if (filterName == "auto")
+    {
+        m_filterSelector->setEnabled(true);
+        return true;
+    }
+    m_filterSelector->setEnabled(false);
+    switchFilter(filterName);
+    return true;
+}
+
+
+/// The offset is the difference of the two one way estimates which only cancels the delay
+/// if both use the same filter. The switch is therefore made at the start of the next burst
+/// on the server and on the client together, see startSampleRun().
+///
+void Device::switchFilter(const std::string& filterName)
+{
+    m_pendingFilter = filterName;
+}
+
+
+/// The direct offset between this client (the peer group initiator) and its peer as measured
+/// by the clients themselves.
+///
+void Device::processPeerOffset(const RxPacket& rx)
+{
+    m_peer = rx.value("peer");
+    m_peerOffset_us = rx.value("offset").toLongLong() / 1000.0;
+
+    QJsonObject json;
+    json["name"] = m_name;
+    json["command"] = "peer_offset";
+    json["peer"] = m_peer;
+    json["time"] = QString::number(SystemTime::getWallClock_ns() / NS_IN_MSEC);
+    json["offset"] = QString::number(m_peerOffset_us);
+    emit signalWebsocketTransmit(json);
+}
+
+
+/// Let the client send its raw timestamps with the forward offset and calculate the offset
+/// from matched packet pairs, see JointOffset.
+///
+void Device::setJointOffset(bool enabled)
+{
+    m_jointOffset = enabled;
+}
+
+
+void Device::setDriftEstimator(OffsetMeasurementHistory::DriftEstimator driftEstimator)
+{
+    m_offsetMeasurementHistory->setDriftEstimator(driftEstimator);
+}
+
+
+/// Adjustments take effect at a given time rather than whenever the client gets around to
+/// parse them. The effective time is in server time together with the latest client offset
+/// so the client can convert it to its own time.
+///
+void Device::setEffectiveTime(QJsonObject& json)
+{
+    m_adjustmentEffective_ns = s_systemTime->getUpdatedSystemTime() + ADJUSTMENT_LEAD_NS;
+    json["at"] = QString::number(m_adjustmentEffective_ns);
+    json["at_offset"] = QString::number(m_lastClientOffset_ns);
+}
+
+
+/// The client reports how late it got to apply an adjustment. The time from the servo run
+/// until the ppm adjustment was actually applied is taken out of the interval the servo
+/// sees for the next measurement.
+///
+void Device::processAdjustmentApplied(const RxPacket& rx)
+{
+    int64_t late_ns = rx.value("late").toLongLong();
+    m_adjustmentLate_us = late_ns / 1000.0;
+    m_maxAdjustmentLate_us = std::max(m_maxAdjustmentLate_us, m_adjustmentLate_us);
+
+    if (rx.value("adjustment") != "adjustclock")
+    {
+        m_adjustmentDelay_sec = (ADJUSTMENT_LEAD_NS + late_ns) / NS_IN_SEC_F;
+    }
+    if (late_ns > ADJUSTMENT_LEAD_NS)
+    {
+        trace->warn("{}{} applied {:.1f} ms late", getLogName(), rx.value("adjustment").toStdString(), late_ns / NS_IN_MSEC_F);
+    }
+}
+
+
+/// The client reports how late it fired a scheduled event on its own clock. Adding the last
+/// measured client offset gives the firing error in server time, positive when late.
+///
+void Device::processEventFired(const RxPacket& rx)
+{
+    double late_us = rx.value("late").toLongLong() / 1000.0;
+    double error_us = late_us + m_lastClientOffset_ns / 1000.0;
+
+    m_eventsFired++;
+    if (std::fabs(error_us) > std::fabs(m_maxEventError_us))
+    {
+        m_maxEventError_us = error_us;
+    }
+
+    trace->info("{}event '{}' fired, error {:.1f} us (late {:.1f} us, offset {:.1f} us)",
+                getLogName(), rx.value("name").toStdString(), error_us, late_us, m_lastClientOffset_ns / 1000.0);
+}
+
+
+/// Let the client send its forward offset and its readiness for the next burst in one message
+/// and get the ppm adjustment and the end of the burst in another, see sampleRunComplete().
+///
+void Device::setPipelined(bool enabled)
+{
+    m_pipelined = enabled;
+}
+
+
+/// A client in holdover has kept its disciplined clock, so it skips the initial ppm
+/// measurements and the clock step and goes straight to tracking.
+///
+void Device::setClientHoldover(bool holdover)
+{
+    if (holdover)
+    {
+        trace->info("{}client is in holdover", getLogName());
+        m_initState = InitState::RUNNING;
+        m_holdoverResume = true;
+    }
+}
+
+
+/// Use short and dense bursts for the initial ppm measurements, see acquiring().
+///
+void Device::setFastAcquisition(bool enabled)
+{
+    m_fastAcquisition = enabled;
+    if (m_initState == InitState::PPM_MEASUREMENTS && !m_offsetMeasurementHistory->size())
+    {
+        m_initStateCounter = initialPPMMeasurements();
+    }
+}
+
+
+/// Until the client is running the bursts are short and dense and follow each other right
+/// away, so the initial ppm is found within seconds. A couple of extra bursts make up for
+/// the shorter timespan of the ppm regression.
+///
+bool Device::acquiring() const
+{
+    return m_fastAcquisition && m_initState != InitState::RUNNING && m_fixedSamplePeriod_ms < 0;
+}
+
+
+int Device::burstSamples() const
+{
+    return acquiring() && !m_lock.hasFixedNofSamples() ? ACQUISITION_SAMPLES : m_lock.getNofSamples();
+}
+
+
+int Device::burstSamplePeriod_ms() const
+{
+    return acquiring() ? ACQUISITION_SAMPLE_PERIOD_MS : m_lock.getSamplePeriod_ms();
+}
+
+
+int Device::initialPPMMeasurements() const
+{
+    return m_fastAcquisition ? NOF_ACQUISITION_PPM_MEASUREMENTS : NOF_INITIAL_PPM_MEASUREMENTS;
+}
+
+
+/// A restarted client that found its own saved frequency. With a recent saved state for it
+/// here as well it only needs a single measurement for the clock step, after which the servo,
+/// the lock and the delay estimates continue from where they were, see restoreDriftState().
+///
+void Device::setClientWarmStart(bool warm)
+{
+    if (!warm)
+    {
+        return;
+    }
+
+    DriftState state = DriftState::load("server_" + m_name);
+    if (!state.m_valid || state.age_hours() < 0.0 || state.age_hours() > DRIFT_STATE_MAX_AGE_HOURS)
+    {
+        trace->info("{}no recent drift state, cold start", getLogName());
+        return;
+    }
+
+    trace->info("{}client warm start", getLogName());
+    m_driftState = state;
+    m_warmStart = true;
+    m_initStateCounter = 1;
+}
+
+
+void Device::restoreDriftState()
+{
+    m_warmStart = false;
+
+    if (m_driftState.m_servo == m_servo->name())
+    {
+        m_servo->setState(m_driftState.m_servoState);
+    }
+    m_offsetMeasurementHistory->seed(m_driftState.m_ppm);
+    m_lock.seed(m_driftState.m_lockQuality);
+    m_burstSpreadBaseline_ns = m_driftState.m_delaySpread_ns;
+    m_probeSpreadBaseline_ns = m_driftState.m_probeSpread_ns;
+
+    trace->info("{}restored {}", getLogName(), m_driftState.toString());
+}
+
+
+/// The residual drift, the lock quality, the servo state and the delay spread baselines are
+/// saved regularly while in high lock.
+///
+void Device::saveDriftState()
+{
+    DriftState state;
+    state.m_saved_ns = SystemTime::getWallClock_ns();
+    state.m_ppm = m_offsetMeasurementHistory->getMovingAveragePPM();
+    state.m_lockQuality = m_lock.getQuality();
+    state.m_servo = m_servo->name();
+    state.m_servoState = m_servo->getState();
+    state.m_delaySpread_ns = m_burstSpreadBaseline_ns;
+    state.m_probeSpread_ns = m_probeSpreadBaseline_ns;
+    state.save("server_" + m_name);
+}
+
+
+/// Abort congested bursts, see monitorBurst().
+///
+void Device::setBurstAbort(bool enabled)
+{
+    m_burstAbort = enabled;
+}
+
+
+/// Start every burst with a short probe of the channel, see processProbe().
+///
+void Device::setProbeBursts(bool enabled)
+{
+    m_probeBursts = enabled;
+}
+
+
+void Device::setCommonModeEstimator(CommonModeEstimator* commonMode)
+{
+    m_commonMode = commonMode;
+}
+
+
+bool Device::setShadowFilters(const std::string& filterList)
+{
+    return m_shadowFilters->setFilters(filterList);
+}
+
+
+/// The shadow filter results so far, the jobs for the latest burst are likely still running.
+///
+void Device::sendShadowFilterStats()
+{
+    QJsonArray filters;
+    for (const ShadowFilterStats& stats : m_shadowFilters->getStats())
+    {
+        QJsonObject filter;
+        filter["filter"] = stats.m_name.c_str();
+        filter["bursts"] = QString::number(stats.m_bursts);
+        filter["passed"] = QString::number(stats.passedPct());
+        filter["diff"] = QString::number(stats.meanDiff_us());
+        filter["rms"] = QString::number(stats.rmsDiff_us());
+        filter["jitter"] = QString::number(stats.jitter_us());
+        filter["offset"] = QString::number(stats.m_lastOffset_ns / 1000.0);
+        filter["used"] = QString::number(stats.m_lastUsedSamples);
+        filter["spread"] = QString::number(stats.m_lastSpread_ns / 1000.0);
+        filters.append(filter);
+    }
+
+    QJsonObject json;
+    json["name"] = m_name;
+    json["command"] = "shadow_filters";
+    json["filters"] = filters;
+    emit signalWebsocketTransmit(json);
+}
+
+
 void Device::slotSendStatus()
 {
     slotNewLockState(m_lock.getLockState());
@@ -676,6 +1429,10 @@ void Device::slotClientConnected()
 
 void Device::clientDisconnected()
 {
+    if (m_clientConnected && m_initState == InitState::RUNNING && m_lock.isHiLock())
+    {
+        saveDriftState();
+    }
     m_clientConnected = false;
     emit signalConnectionLost(m_name);
 }
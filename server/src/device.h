@@ -7,6 +7,9 @@
 #include "rxpacket.h"
 #include "lock.h"
 #include "mathfunc.h"
+#include "clockservo.h"
+#include "driftstate.h"
+#include "offsetmeasurementhistory.h"
 
 #include <QString>
 #include <QIODevice>
@@ -15,8 +18,10 @@
 #include <QHostAddress>
 #include <QJsonObject>
 
-class OffsetMeasurementHistory;
 class MeasurementSeriesBase;
+class ShadowFilters;
+class FilterSelector;
+class CommonModeEstimator;
 class QTcpServer;
 class QTcpSocket;
 class QUdpSocket;
@@ -76,6 +81,13 @@ enum InitState
     RUNNING
 };
 
+
+enum BurstStage
+{
+    PROBE,
+    MEASURE
+};
+
 class Device : public QObject
 {
     Q_OBJECT
@@ -93,20 +105,53 @@ public:
     std::string name() const;
     void measurementStart();
     void getClientOffset();
+    void sampleRunEnded();
     std::string getStatusReport();
     void measurementCollisionNotice();
+    void setServo(ClockServo::ServoType servoType, const ServoParameters& parameters);
+    void setServoParameters(const ServoParameters& parameters);
+    const ClockServo* servo() const;
+    void sendShadowFilterStats();
+    void setCommonModeEstimator(CommonModeEstimator* commonMode);
+    void processPeerOffset(const RxPacket& rx);
+    bool setFilter(const std::string& filterName);
+    void switchFilter(const std::string& filterName);
+    bool setShadowFilters(const std::string& filterList);
+    void setJointOffset(bool enabled);
+    void setDriftEstimator(OffsetMeasurementHistory::DriftEstimator driftEstimator);
+    void setProbeBursts(bool enabled);
+    void setBurstAbort(bool enabled);
+    void setPipelined(bool enabled);
+    void setClientHoldover(bool holdover);
+    void setClientWarmStart(bool warm);
+    void setFastAcquisition(bool enabled);
+    void setEffectiveTime(QJsonObject& json);
+    void processAdjustmentApplied(const RxPacket& rx);
+    void processEventFired(const RxPacket& rx);
 
 private:
     void clientDisconnected();
     void timerEvent(QTimerEvent *event);
     void sampleRunComplete();
+    void scheduleNextBurst();
+    void startSampleRun(int count, bool discard);
+    void processProbe();
+    void monitorBurst();
+    void abortBurst();
+    bool acquiring() const;
+    int burstSamples() const;
+    int burstSamplePeriod_ms() const;
+    int initialPPMMeasurements() const;
+    void restoreDriftState();
+    void saveDriftState();
     std::string getLogName() const;
 
 signals:
     void signalRequestSamples(Device*, int, int);
     void signalConnectionLost(QString name);
-    void signalNewOffsetMeasurement(const QString&, double, double, double);
+    void signalNewOffsetMeasurement(const QString&, qint64, double, double, double);
     void signalWebsocketTransmit(const QJsonObject& json);
+    void signalCancelSamples(const QString& name);
 
 public slots:
     void slotSendStatus();
@@ -124,6 +169,8 @@ public:
     QTcpSocket *m_tcpSocket;
     int m_clientActiveTimer = TIMEROFF;
     int m_sampleRunTimer = TIMEROFF;
+    int m_mainBurstTimer = TIMEROFF;
+    int m_abortBurstTimer = TIMEROFF;
     int m_clientPingTimer = TIMEROFF;
     int m_clientPingCounter = 0;
     QString m_serverAddress;
@@ -138,9 +185,99 @@ public:
 
     int m_initStateCounter = NOF_INITIAL_PPM_MEASUREMENTS;
     InitState m_initState = InitState::PPM_MEASUREMENTS;
+    bool m_holdoverResume = false;
+
+    // short and dense bursts back to back until the client is running, see acquiring()
+    bool m_fastAcquisition = true;
+    const int ACQUISITION_SAMPLES = 250;
+    const int ACQUISITION_SAMPLE_PERIOD_MS = 4;
+    const int NOF_ACQUISITION_PPM_MEASUREMENTS = 5;
+
+    // running time when the client connected, see slotNewLockState()
+    double m_connectTime_sec = 0.0;
+    double m_timeToLock_sec = -1.0;
+    double m_timeToHiLock_sec = -1.0;
+    // a client back from holdover with an offset larger than this is stepped as a new client
+    const int64_t HOLDOVER_STEP_LIMIT_NS = 1000000;
+
+    // what was known about the client before it restarted, see setClientWarmStart()
+    DriftState m_driftState;
+    bool m_warmStart = false;
+    int m_driftStateCounter = 0;
+    const int DRIFT_STATE_SAVE_PERIOD = 20;
+    const double DRIFT_STATE_MAX_AGE_HOURS = 7 * 24.0;
 
     MeasurementSeriesBase* m_measurementSeries;
     OffsetMeasurementHistory* m_offsetMeasurementHistory;
+    ClockServo* m_servo = nullptr;
+    ShadowFilters* m_shadowFilters = nullptr;
+    FilterSelector* m_filterSelector = nullptr;
+    CommonModeEstimator* m_commonMode = nullptr;
+    // applied at the start of the next burst, see switchFilter()
+    std::string m_pendingFilter;
+    QString m_peer;
+    double m_peerOffset_us = 0.0;
+
+    const double PEER_GROUP_SILENCE_FACTOR = 2.0;
+
+    bool m_probeBursts = false;
+    BurstStage m_burstStage = BurstStage::MEASURE;
+    bool m_probePostponed = false;
+    int m_mainBurstSamples = 0;
+    int64_t m_probeWindow_ns = 0;
+    int m_probePostponements = 0;
+    int m_probesPostponed = 0;
+    double m_probeSpread_ns = 0.0;
+    double m_probeSpreadBaseline_ns = 0.0;
+
+    const int PROBE_SAMPLES = 25;
+    const int PROBE_RETRY_SEC = 2;
+    const int PROBE_MAX_POSTPONEMENTS = 3;
+    // a probe spread this many times the baseline means that the channel is congested
+    const double PROBE_CONGESTION_FACTOR = 3.0;
+    const double PROBE_WINDOW_FACTOR = 4.0;
+    const int64_t PROBE_MIN_WINDOW_NS = 200000;
+    const int64_t PROBE_MAX_WINDOW_NS = 1000000;
+
+    int64_t m_lastClientOffset_ns = 0;
+    int m_eventsFired = 0;
+    double m_maxEventError_us = 0.0;
+    double m_adjustmentLate_us = 0.0;
+    double m_maxAdjustmentLate_us = 0.0;
+    double m_adjustmentDelay_sec = 0.0;
+    // server time of the latest adjustment sent, the next burst starts after it
+    int64_t m_adjustmentEffective_ns = 0;
+    // the time from sending an adjustment until it takes effect on the client, covers the
+    // tcp latency including some retries
+    const int64_t ADJUSTMENT_LEAD_NS = 50000000;
+
+    bool m_pipelined = true;
+    bool m_clientReady = false;
+    QJsonObject m_burstCompleteReply;
+
+    bool m_burstAbort = true;
+    bool m_burstAborted = false;
+    int m_burstAborts = 0;
+    int m_burstBackoff_sec = 0;
+    int m_burstSent = 0;
+    int m_blockSent = 0;
+    int m_congestedBlocks = 0;
+    int64_t m_burstFloor_ns = 0;
+    SampleList64 m_blockDelays;
+    double m_burstSpreadBaseline_ns = 0.0;
+
+    const int ABORT_BLOCK_SAMPLES = 25;
+    const int ABORT_BLOCKS = 2;
+    const double ABORT_LOSS = 0.5;
+    // a block median this many times the baseline burst spread above the burst floor is congestion
+    const double ABORT_INFLATION_FACTOR = 4.0;
+    const int64_t ABORT_MIN_INFLATION_NS = 200000;
+    const int ABORT_MIN_BACKOFF_SEC = 2;
+    const int ABORT_MAX_BACKOFF_SEC = 32;
+
+    bool m_jointOffset = false;
+    size_t m_jointPairs = 0;
+    double m_jointOffsetDiff_us = 0.0;
 
     double m_avgRoundtrip_us = 0.0;
     bool m_averagesInitialized = false;
@@ -4,10 +4,13 @@
 #include "websocket.h"
 #include "globals.h"
 #include "i2c_access.h"
+#include "filterpipeline.h"
 
 #include <QTcpServer>
 #include <QJsonArray>
 
+#include <algorithm>
+
 DeviceManager::DeviceManager()
 {
     connect(&m_samples, &Samples::signalSendTimeSample,
@@ -84,10 +87,30 @@ void DeviceManager::process(const MulticastRxPacket& rx)
         }
         Device* newDevice = new Device(this, from);
         m_deviceDeque.append(newDevice);
+        newDevice->setCommonModeEstimator(&m_commonMode);
+        newDevice->setServo(m_servoType, m_servoParameters);
+        if (!m_filterName.empty())
+        {
+            newDevice->setFilter(m_filterName);
+        }
+        if (!m_shadowFilterList.empty())
+        {
+            newDevice->setShadowFilters(m_shadowFilterList);
+        }
+        newDevice->setJointOffset(m_jointOffset);
+        newDevice->setDriftEstimator(m_driftEstimator);
+        newDevice->setProbeBursts(m_probeBursts);
+        newDevice->setBurstAbort(m_burstAbort);
+        newDevice->setPipelined(m_pipelined);
+        newDevice->setFastAcquisition(m_fastAcquisition);
+        newDevice->setClientHoldover(rx.value("holdover") == "1");
+        newDevice->setClientWarmStart(rx.value("warm") == "1");
 
         connect(newDevice, &Device::signalRequestSamples, &m_samples, &Samples::slotRequestSamples);
         connect(newDevice, &Device::signalConnectionLost, this, &DeviceManager::slotConnectionLost);
         connect(newDevice, &Device::signalNewOffsetMeasurement, m_webSocket, &WebSocket::slotNewOffsetMeasurement);
+        connect(newDevice, &Device::signalWebsocketTransmit, this, &DeviceManager::slotWebsocketTransmit);
+        connect(newDevice, &Device::signalCancelSamples, &m_samples, &Samples::removeClient);
         connect(m_webSocket, &WebSocket::signalNewWebsocketConnection, this, &DeviceManager::slotNewWebsocketConnection);
         connect(&newDevice->m_lock, &Lock::signalNewLockQuality, this, &DeviceManager::slotNewLockQuality);
 
@@ -129,7 +152,7 @@ void DeviceManager::slotSampleRunStatusUpdate(const QString& client, bool active
         Device* device = findDevice(client);
         if (device)
         {
-            device->getClientOffset();
+            device->sampleRunEnded();
         }
         if (m_activeClients.empty())
         {
@@ -146,6 +169,7 @@ void DeviceManager::slotConnectionLost(const QString& client)
         if (m_deviceDeque.at(i)->m_name == client)
         {
             m_samples.removeClient(client);
+            m_commonMode.removeDevice(client);
             Device* device = m_deviceDeque.takeAt(i);
             device->deleteLater();
             trace->warn(RED "{} connection lost, removing client. Clients connected: {}" RESET,
@@ -212,6 +236,242 @@ void DeviceManager::sendVctcxoDac(const QString& from, const QString& value)
 }
 
 
+/// Select servo and/or servo parameters for a single client, or for all clients including
+/// those connecting later if no client is given. An empty servo name keeps the current servo(s)
+/// and only applies the parameters.
+///
+void DeviceManager::setServo(const QString& client, const QString& servo, const QString& parameters)
+{
+    ClockServo::ServoType servoType = m_servoType;
+    if (!servo.isEmpty() && !ClockServo::fromString(servo.toStdString(), servoType))
+    {
+        trace->error("unknown servo '{}'", servo.toStdString());
+        return;
+    }
+
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (!allClients && device->m_name != client)
+        {
+            continue;
+        }
+
+        ServoParameters servoParameters = allClients ? m_servoParameters : device->servo()->parameters();
+        servoParameters.parse(parameters.toStdString());
+
+        if (servo.isEmpty())
+        {
+            device->setServoParameters(servoParameters);
+        }
+        else
+        {
+            device->setServo(servoType, servoParameters);
+        }
+    }
+
+    if (allClients)
+    {
+        m_servoType = servoType;
+        m_servoParameters.parse(parameters.toStdString());
+    }
+}
+
+
+/// Select the sample filter pipeline by name for a single client, or for all clients
+/// including those connecting later if no client is given. 'auto' selects the filter per
+/// client from how the filters perform, see FilterSelector. It is off by default.
+///
+void DeviceManager::setFilter(const QString& client, const QString& filter)
+{
+    std::string filterName = filter.toStdString();
+    std::vector<std::string> names = SampleFilter::names();
+    if (filterName != "auto" && std::find(names.begin(), names.end(), filterName) == names.end())
+    {
+        trace->error("unknown sample filter '{}'", filterName);
+        return;
+    }
+
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (allClients || device->m_name == client)
+        {
+            device->setFilter(filterName);
+        }
+    }
+
+    if (allClients)
+    {
+        m_filterName = filterName;
+    }
+}
+
+
+/// Run the filters in shadow mode next to the production filter, see ShadowFilters::setFilters()
+/// for the filter list format. For a single client or for all clients including those connecting
+/// later if no client is given.
+///
+void DeviceManager::setShadowFilters(const QString& client, const QString& filterList)
+{
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (allClients || device->m_name == client)
+        {
+            device->setShadowFilters(filterList.toStdString());
+        }
+    }
+
+    if (allClients)
+    {
+        m_shadowFilterList = filterList.toStdString();
+    }
+}
+
+
+/// Calculate the offset from matched packet pairs using the raw client timestamps, for a
+/// single client or for all clients including those connecting later if no client is given.
+///
+void DeviceManager::setJointOffset(const QString& client, bool enabled)
+{
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (allClients || device->m_name == client)
+        {
+            device->setJointOffset(enabled);
+        }
+    }
+
+    if (allClients)
+    {
+        m_jointOffset = enabled;
+    }
+}
+
+
+/// Select the drift estimator for the ppm regression, see OffsetMeasurementHistory. For a
+/// single client or for all clients including those connecting later.
+///
+void DeviceManager::setDriftEstimator(const QString& client, const QString& estimator)
+{
+    OffsetMeasurementHistory::DriftEstimator driftEstimator;
+    if (!OffsetMeasurementHistory::fromString(estimator.toStdString(), driftEstimator))
+    {
+        trace->error("unknown drift estimator '{}'", estimator.toStdString());
+        return;
+    }
+
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (allClients || device->m_name == client)
+        {
+            device->setDriftEstimator(driftEstimator);
+        }
+    }
+
+    if (allClients)
+    {
+        m_driftEstimator = driftEstimator;
+    }
+}
+
+
+/// Start every burst with a short probe that sizes the burst or postpones it if the channel
+/// is congested. For a single client or for all clients including those connecting later.
+///
+void DeviceManager::setProbeBursts(const QString& client, bool enabled)
+{
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (allClients || device->m_name == client)
+        {
+            device->setProbeBursts(enabled);
+        }
+    }
+
+    if (allClients)
+    {
+        m_probeBursts = enabled;
+    }
+}
+
+
+/// Abort bursts that run into a congested channel, on by default. For a single client or
+/// for all clients including those connecting later.
+///
+void DeviceManager::setBurstAbort(const QString& client, bool enabled)
+{
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (allClients || device->m_name == client)
+        {
+            device->setBurstAbort(enabled);
+        }
+    }
+
+    if (allClients)
+    {
+        m_burstAbort = enabled;
+    }
+}
+
+
+/// Pipeline the control exchange after a burst, on by default. For a single client or for all
+/// clients including those connecting later.
+///
+void DeviceManager::setPipelined(const QString& client, bool enabled)
+{
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (allClients || device->m_name == client)
+        {
+            device->setPipelined(enabled);
+        }
+    }
+
+    if (allClients)
+    {
+        m_pipelined = enabled;
+    }
+}
+
+
+/// Short back to back bursts until the client is running, on by default. For a single client
+/// or for all clients including those connecting later.
+///
+void DeviceManager::setFastAcquisition(const QString& client, bool enabled)
+{
+    bool allClients = client.isEmpty() || client == "all";
+
+    for(auto device : m_deviceDeque)
+    {
+        if (allClients || device->m_name == client)
+        {
+            device->setFastAcquisition(enabled);
+        }
+    }
+
+    if (allClients)
+    {
+        m_fastAcquisition = enabled;
+    }
+}
+
+
 void DeviceManager::slotNewLockQuality(const QString& name)
 {
     for(auto device : m_deviceDeque)
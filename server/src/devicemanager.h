@@ -2,6 +2,9 @@
 
 #include "multicast.h"
 #include "samples.h"
+#include "clockservo.h"
+#include "commonmode.h"
+#include "offsetmeasurementhistory.h"
 
 #include <QJsonObject>
 #include <deque>
@@ -30,6 +33,15 @@ public:
     bool idle() const;
     WebSocket* webSocket();
     void sendVctcxoDac(const QString& from, const QString& value);
+    void setServo(const QString& client, const QString& servo, const QString& parameters);
+    void setFilter(const QString& client, const QString& filter);
+    void setShadowFilters(const QString& client, const QString& filterList);
+    void setJointOffset(const QString& client, bool enabled);
+    void setDriftEstimator(const QString& client, const QString& estimator);
+    void setProbeBursts(const QString& client, bool enabled);
+    void setBurstAbort(const QString& client, bool enabled);
+    void setPipelined(const QString& client, bool enabled);
+    void setFastAcquisition(const QString& client, bool enabled);
 
 signals:
     void signalMulticastTx(MulticastTxPacket& tx);
@@ -51,4 +63,15 @@ private:
     bool m_multicastTime = false;
     QVector<QString> m_activeClients;
     WebSocket* m_webSocket;
+    ClockServo::ServoType m_servoType = ClockServo::DEFAULT;
+    ServoParameters m_servoParameters;
+    std::string m_filterName;
+    std::string m_shadowFilterList;
+    bool m_jointOffset = false;
+    OffsetMeasurementHistory::DriftEstimator m_driftEstimator = OffsetMeasurementHistory::WEIGHTED_LEAST_SQUARES;
+    bool m_probeBursts = false;
+    bool m_burstAbort = true;
+    bool m_pipelined = true;
+    bool m_fastAcquisition = true;
+    CommonModeEstimator m_commonMode;
 };
@@ -0,0 +1,101 @@
+#include "jointoffset.h"
+
+#include "spdlog/fmt/fmt.h"
+
+#include <algorithm>
+
+
+const size_t JointOffset::MIN_PAIRS;
+
+
+std::string JointOffsetResult::toString() const
+{
+    return fmt::format("joint offset {:.3f} us, roundtrip {:.3f} us from {} of {} pairs{}",
+                       m_offset_ns / 1000.0, m_roundtrip_ns / 1000.0, m_usedPairs, m_pairs,
+                       m_valid ? "" : " (invalid)");
+}
+
+
+/// The server sent serverSent[i] which the client got at clientReceived[i], and the client
+/// sent clientSent[j] which the server got at serverReceived[j]. Both lists are in the order
+/// the packets arrived. The offset has the same sign as the offset calculated from the two
+/// directions.
+///
+JointOffsetResult JointOffset::calculate(const SampleList64& serverSent, const SampleList64& clientReceived,
+                                         const SampleList64& clientSent, const SampleList64& serverReceived,
+                                         double drift_ppm)
+{
+    JointOffsetResult result;
+
+    struct Pair
+    {
+        int64_t m_time_ns;
+        int64_t m_offset_ns;
+        int64_t m_roundtrip_ns;
+    };
+    std::vector<Pair> pairs;
+
+    size_t clientSamples = std::min(serverSent.size(), clientReceived.size());
+    size_t serverSamples = std::min(clientSent.size(), serverReceived.size());
+    size_t i = 0;
+
+    for (size_t j = 0; j < serverSamples && i < clientSamples; j++)
+    {
+        // the latest server packet the client got before sending this answer
+        while (i + 1 < clientSamples && clientReceived[i + 1] <= clientSent[j])
+        {
+            i++;
+        }
+
+        int64_t echo_ns = clientSent[j] - clientReceived[i];
+        if (echo_ns < 0 || echo_ns > ECHO_WINDOW_NS)
+        {
+            continue;
+        }
+
+        int64_t forward_ns = clientReceived[i] - serverSent[i];
+        int64_t backward_ns = serverReceived[j] - clientSent[j];
+
+        Pair pair;
+        pair.m_time_ns = serverReceived[j];
+        pair.m_offset_ns = (backward_ns - forward_ns) / 2;
+        pair.m_roundtrip_ns = forward_ns + backward_ns;
+        pairs.push_back(pair);
+
+        // a server packet can only be answered once
+        i++;
+    }
+
+    result.m_pairs = pairs.size();
+    if (pairs.size() < MIN_PAIRS)
+    {
+        return result;
+    }
+
+    if (drift_ppm != 0.0)
+    {
+        int64_t midpoint = pairs.front().m_time_ns + (pairs.back().m_time_ns - pairs.front().m_time_ns) / 2;
+        for (auto& pair : pairs)
+        {
+            pair.m_offset_ns -= (pair.m_time_ns - midpoint) * drift_ppm / 1000000.0;
+        }
+    }
+
+    size_t used = std::max(MIN_PAIRS, (size_t) (pairs.size() * USED_FRACTION));
+    std::nth_element(pairs.begin(), pairs.begin() + used - 1, pairs.end(),
+                     [](const Pair& a, const Pair& b) { return a.m_roundtrip_ns < b.m_roundtrip_ns; });
+
+    SampleList64 offsets;
+    SampleList64 roundtrips;
+    for (size_t n = 0; n < used; n++)
+    {
+        offsets.push_back(pairs[n].m_offset_ns);
+        roundtrips.push_back(pairs[n].m_roundtrip_ns);
+    }
+
+    result.m_offset_ns = MathFunc::median(offsets);
+    result.m_roundtrip_ns = MathFunc::median(roundtrips);
+    result.m_usedPairs = used;
+    result.m_valid = true;
+    return result;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "mathfunc.h"
+
+#include <string>
+
+
+struct JointOffsetResult
+{
+    bool m_valid = false;
+    int64_t m_offset_ns = 0;
+    int64_t m_roundtrip_ns = 0;
+    size_t m_pairs = 0;
+    size_t m_usedPairs = 0;
+
+    std::string toString() const;
+};
+
+
+/// Client offset from matched packet pairs rather than from the two independently filtered
+/// directions. The client echoes every server packet right away so a server packet and the
+/// client answer it triggered form a pair with its own roundtrip. Only the pairs with the
+/// lowest roundtrip are used, i.e. the pairs where neither direction was delayed, and the
+/// offset is the median of their individual offsets.
+///
+class JointOffset
+{
+public:
+    static JointOffsetResult calculate(const SampleList64& serverSent, const SampleList64& clientReceived,
+                                       const SampleList64& clientSent, const SampleList64& serverReceived,
+                                       double drift_ppm);
+
+private:
+    // the longest time from a client receiving a server packet until it sends its answer
+    static const int64_t ECHO_WINDOW_NS = 1000000;
+    static const size_t MIN_PAIRS = 10;
+    static constexpr double USED_FRACTION = 0.2;
+};
@@ -47,7 +47,7 @@ int Lock::getInterMeasurementDelaySecs() const
         {
             return s_fixedMeasurementSilence_sec;
         }
-        return std::max(Seconds[m_quality] - Samples[m_quality] * getSamplePeriod_ms() / 1000.0, 0.0);
+        return std::max(Seconds[m_quality] * m_silenceFactor - Samples[m_quality] * getSamplePeriod_ms() / 1000.0, 0.0);
     }
     return 0;
 }
@@ -91,6 +91,15 @@ void Lock::setFixedSamplePeriod_ms(int ms)
 }
 
 
+/// Stretch the automatic measurement period, e.g. for clients in a peer group that
+/// mostly keeps in sync directly with each other.
+///
+void Lock::setSilenceFactor(double factor)
+{
+    m_silenceFactor = factor;
+}
+
+
 int Lock::getMeasurementPeriod_sec() const
 {
     return Seconds[m_quality];
@@ -106,6 +115,18 @@ int Lock::getNofSamples() const
 }
 
 
+int Lock::getMaxNofSamples() const
+{
+    return m_maxSamples;
+}
+
+
+bool Lock::hasFixedNofSamples() const
+{
+    return s_clientSamples >= 0;
+}
+
+
 int Lock::getQuality() const
 {
     return m_quality;
@@ -146,7 +167,6 @@ Lock::LockState Lock::update(double offset)
 {
     LockState lockState = m_lockState;
     int quality = m_quality;
-    const int LOCK_COUNTS = 3;
 
     const double UNLOCK_THRESHOLD = 50.0;
     const double STDLOCK_THRESHOLD = 30.0;
@@ -235,3 +255,20 @@ void Lock::panic()
         m_lockState = LOCKED;
     }
 }
+
+
+/// Resume with the lock quality from before a restart, see DriftState. The lock starts out
+/// as locked and the next good measurement gives a high lock.
+///
+void Lock::seed(int quality)
+{
+    m_quality = std::max(0, std::min(quality, QUALITY_LEVELS - 1));
+    m_counter = LOCK_COUNTS + 1;
+    if (m_lockState != LOCKED)
+    {
+        trace->info("[{}] lock status changed from {} to {}", m_clientName, toColorString(m_lockState), toColorString(LOCKED));
+        m_lockState = LOCKED;
+        emit signalNewLockState(m_lockState);
+    }
+    emit signalNewLockQuality(QString(m_clientName.c_str()));
+}
@@ -10,6 +10,7 @@ class Lock : public QObject
     Q_OBJECT
 
     const static int QUALITY_LEVELS = 12;
+    const static int LOCK_COUNTS = 3;
 
 #ifdef VCTCXO
     const int MIN_SAMPLE_INTERVAL_ms = 10;
@@ -47,16 +48,20 @@ public:
     int getSamplePeriod_ms() const;
     int getMeasurementPeriod_sec() const;
     int getNofSamples() const;
+    int getMaxNofSamples() const;
+    bool hasFixedNofSamples() const;
     int getQuality() const;
     Distribution getDistribution() const;
     LockState update(double offset);
     void panic();
+    void seed(int quality);
 
     static std::string toColorString(LockState state);
     static std::string toString(LockState state);
     static void setFixedMeasurementSilence_sec(int period);
     static void setFixedClientSamples(int samples);
     void setFixedSamplePeriod_ms(int ms);
+    void setSilenceFactor(double factor);
 
 signals:
     void signalNewLockState(LockState lockState);
@@ -74,6 +79,7 @@ private:
     static int s_fixedMeasurementSilence_sec;
     static int s_clientSamples;
     int m_fixedSamplePeriod_ms = -1;
+    double m_silenceFactor = 1.0;
 
     const int Samples[QUALITY_LEVELS] = {500, 450, 400, 360, 330, 300, 270, 250, 230, 220, 210, 200};
     const int Seconds[QUALITY_LEVELS] = {  5,   7,  10,  15,  22,  32,  45,  50,  60,  75,  90, 110};
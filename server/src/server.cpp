@@ -64,6 +64,28 @@ void Server::startServer()
     m_deviceManager.initialize();
     connect(&m_deviceManager, &DeviceManager::signalMulticastTx, this, &Server::slotMulticastTx );
     connect(&m_deviceManager, &DeviceManager::signalIdle, this, &Server::slotIdle );
+
+    m_announcements = NOF_ANNOUNCEMENTS;
+    timerOn(this, m_announceTimer, ANNOUNCE_PERIOD_MS);
+}
+
+
+/// Tell the clients that are waiting for a server, e.g. after a server restart, that there
+/// is one now. They then send their connect request right away.
+///
+void Server::announce()
+{
+    trace->debug("announcing server");
+    QJsonObject json;
+    json["to"] = "all";
+    json["command"] = "serverannounce";
+    MulticastTxPacket tx(json);
+    slotMulticastTx(tx);
+
+    if (--m_announcements <= 0)
+    {
+        timerOff(this, m_announceTimer);
+    }
 }
 
 
@@ -115,6 +137,74 @@ void Server::executeControl(const MulticastRxPacket& rx)
         trace->info("setting samples to {}", rx.value("value").toStdString());
         Lock::setFixedClientSamples(rx.value("value") == "auto" ? -1 : rx.value("value").toInt());
     }
+    else if (action == "servo")
+    {
+        trace->info("setting servo '{}' with parameters '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("parameters").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setServo(rx.value("client"), rx.value("value"), rx.value("parameters"));
+    }
+    else if (action == "filter")
+    {
+        trace->info("setting sample filter '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setFilter(rx.value("client"), rx.value("value"));
+    }
+    else if (action == "shadow")
+    {
+        trace->info("setting shadow filters '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setShadowFilters(rx.value("client"), rx.value("value"));
+    }
+    else if (action == "joint")
+    {
+        trace->info("setting joint offset estimation '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setJointOffset(rx.value("client"), rx.value("value") == "on");
+    }
+    else if (action == "driftestimator")
+    {
+        trace->info("setting drift estimator '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setDriftEstimator(rx.value("client"), rx.value("value"));
+    }
+    else if (action == "probe")
+    {
+        trace->info("setting probe bursts '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setProbeBursts(rx.value("client"), rx.value("value") == "on");
+    }
+    else if (action == "burstabort")
+    {
+        trace->info("setting burst abort '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setBurstAbort(rx.value("client"), rx.value("value") == "on");
+    }
+    else if (action == "event")
+    {
+        scheduleEvent(rx.value("client"), rx.value("value"), rx.value("delay").toInt());
+    }
+    else if (action == "fastacquisition")
+    {
+        trace->info("setting fast acquisition '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setFastAcquisition(rx.value("client"), rx.value("value") == "on");
+    }
+    else if (action == "pipeline")
+    {
+        trace->info("setting pipelined burst control '{}' for {}",
+                    rx.value("value").toStdString(),
+                    rx.value("client").isEmpty() ? "all" : rx.value("client").toStdString());
+        m_deviceManager.setPipelined(rx.value("client"), rx.value("value") == "on");
+    }
     else
     {
         trace->warn("control command not recognized, {}", action);
@@ -122,6 +212,30 @@ void Server::executeControl(const MulticastRxPacket& rx)
 }
 
 
+/// Let the client(s) fire the event 'name' delay_ms from now, see EventScheduler in libtwitse.
+///
+void Server::scheduleEvent(const QString& client, const QString& name, int delay_ms)
+{
+    if (delay_ms <= 0)
+    {
+        delay_ms = DEFAULT_EVENT_DELAY_MS;
+    }
+    int64_t at_ns = s_systemTime->getUpdatedSystemTime() + delay_ms * NS_IN_MSEC;
+
+    trace->info("scheduling event '{}' for {} in {} ms",
+                name.toStdString(), client.isEmpty() ? "all" : client.toStdString(), delay_ms);
+
+    QJsonObject json;
+    json["to"] = client.isEmpty() ? "all" : client;
+    json["command"] = "event";
+    json["action"] = "schedule";
+    json["name"] = name;
+    json["at"] = QString::number(at_ns);
+    MulticastTxPacket tx(json);
+    slotMulticastTx(tx);
+}
+
+
 /// Process metrics sent from clients. This will currently originate in the web department.
 ///
 void Server::processMetric(const MulticastRxPacket& rx)
@@ -177,6 +291,12 @@ void Server::printStatusReport()
     {
         trace->info(CYAN "      {}" RESET, device->getStatusReport());
     }
+
+    std::string syncMatrix = m_deviceManager.webSocket()->syncMatrix().getReport();
+    if (!syncMatrix.empty())
+    {
+        trace->info(CYAN "      sync {}" RESET, syncMatrix);
+    }
 }
 
 
@@ -249,6 +369,10 @@ void Server::timerEvent(QTimerEvent* timerEvent)
             m_pendingStatusReport = true;
         }
     }
+    else if (id == m_announceTimer)
+    {
+        announce();
+    }
     else if (VCTCXO_MODE && id == m_wallAdjustColdstartTimer)
     {
         // Establish the initial soft ppm correction between server wall clock and raw clock
@@ -23,6 +23,7 @@ public:
 
     void executeControl(const MulticastRxPacket& rx);
     void processMetric(const MulticastRxPacket& rx);
+    void scheduleEvent(const QString& client, const QString& name, int delay_ms);
     void printStatusReport();
 
 public slots:
@@ -31,6 +32,7 @@ public slots:
 
 private:
     void startServer();
+    void announce();
     void adjustRealtimeSoftPPM();
     void timerEvent(QTimerEvent *);
 
@@ -42,6 +44,11 @@ private:
     Multicast* m_multicast;
     DeviceManager m_deviceManager;
     int m_statusReportTimer = TIMEROFF;
+    int m_announceTimer = TIMEROFF;
+    int m_announcements = 0;
+    // a few announcements at startup, waiting clients connect right away instead of at their next retry
+    const int NOF_ANNOUNCEMENTS = 4;
+    const int ANNOUNCE_PERIOD_MS = 500;
 
     bool m_pendingStatusReport = false;
     QString m_uid = QUuid::createUuid().toString();
@@ -50,4 +57,6 @@ private:
     int m_wallAdjustColdstartTimer = TIMEROFF;
     int m_wallSaveNewDefaultDAC = TIMEROFF;
     const int m_wallAdjustPeriodSecs = 30;
+    // long enough for the multicast to reach all clients, also on a busy wifi
+    const int DEFAULT_EVENT_DELAY_MS = 1000;
 };
@@ -0,0 +1,300 @@
+#include "syncmatrix.h"
+#include "spdlog/fmt/fmt.h"
+
+#include <QJsonArray>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+StreamingQuantile::StreamingQuantile(double quantile)
+    : m_quantile(quantile)
+{
+    for (int i = 0; i < 5; i++)
+    {
+        m_heights[i] = 0.0;
+        m_positions[i] = i + 1;
+    }
+    m_desired[0] = 1;
+    m_desired[1] = 1 + 2 * quantile;
+    m_desired[2] = 1 + 4 * quantile;
+    m_desired[3] = 3 + 2 * quantile;
+    m_desired[4] = 5;
+    m_increments[0] = 0;
+    m_increments[1] = quantile / 2;
+    m_increments[2] = quantile;
+    m_increments[3] = (1 + quantile) / 2;
+    m_increments[4] = 1;
+}
+
+
+void StreamingQuantile::add(double x)
+{
+    if (m_count < 5)
+    {
+        m_heights[m_count++] = x;
+        if (m_count == 5)
+        {
+            std::sort(m_heights, m_heights + 5);
+        }
+        return;
+    }
+    m_count++;
+
+    int k;
+    if (x < m_heights[0])
+    {
+        m_heights[0] = x;
+        k = 0;
+    }
+    else if (x >= m_heights[4])
+    {
+        m_heights[4] = x;
+        k = 3;
+    }
+    else
+    {
+        k = 0;
+        while (x >= m_heights[k + 1])
+        {
+            k++;
+        }
+    }
+
+    for (int i = k + 1; i < 5; i++)
+    {
+        m_positions[i]++;
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        m_desired[i] += m_increments[i];
+    }
+
+    for (int i = 1; i < 4; i++)
+    {
+        double d = m_desired[i] - m_positions[i];
+        if ((d >= 1 && m_positions[i + 1] - m_positions[i] > 1) ||
+            (d <= -1 && m_positions[i - 1] - m_positions[i] < -1))
+        {
+            int sign = d > 0 ? 1 : -1;
+            double height = parabolic(i, sign);
+            if (m_heights[i - 1] < height && height < m_heights[i + 1])
+            {
+                m_heights[i] = height;
+            }
+            else
+            {
+                m_heights[i] = linear(i, sign);
+            }
+            m_positions[i] += sign;
+        }
+    }
+}
+
+
+/// Until there are 5 observations the quantile is taken from the sorted observations.
+///
+double StreamingQuantile::value() const
+{
+    if (m_count == 0)
+    {
+        return 0.0;
+    }
+    if (m_count < 5)
+    {
+        std::vector<double> sorted(m_heights, m_heights + m_count);
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[std::min(m_count - 1, int(m_quantile * m_count))];
+    }
+    return m_heights[2];
+}
+
+
+double StreamingQuantile::parabolic(int i, double d) const
+{
+    return m_heights[i] + d / (m_positions[i + 1] - m_positions[i - 1]) *
+            ((m_positions[i] - m_positions[i - 1] + d) * (m_heights[i + 1] - m_heights[i]) /
+             (m_positions[i + 1] - m_positions[i]) +
+             (m_positions[i + 1] - m_positions[i] - d) * (m_heights[i] - m_heights[i - 1]) /
+             (m_positions[i] - m_positions[i - 1]));
+}
+
+
+double StreamingQuantile::linear(int i, int d) const
+{
+    return m_heights[i] + d * (m_heights[i + d] - m_heights[i]) / (m_positions[i + d] - m_positions[i]);
+}
+
+// ---------------------------------------------------
+
+
+PairStatistics::PairStatistics()
+    : m_p50(0.50),
+      m_p95(0.95),
+      m_p99(0.99)
+{
+}
+
+
+void PairStatistics::add(double diff_us)
+{
+    double absolute_us = std::fabs(diff_us);
+    m_count++;
+    m_last_us = diff_us;
+    m_max_us = std::max(m_max_us, absolute_us);
+    m_p50.add(absolute_us);
+    m_p95.add(absolute_us);
+    m_p99.add(absolute_us);
+}
+
+// ---------------------------------------------------
+
+
+/// Add an offset for a client and evaluate the instants that are now complete. Returns
+/// the number of instants evaluated.
+///
+int SyncMatrix::add(const QString& id, int64_t time_ms, double offset_us)
+{
+    m_trajectories[id].append({time_ms, offset_us});
+
+    if (!m_nextInstant_ms)
+    {
+        m_nextInstant_ms = (time_ms / m_gridPeriod_ms + 1) * m_gridPeriod_ms;
+    }
+
+    int evaluated = 0;
+    while (m_nextInstant_ms + m_latency_ms <= time_ms)
+    {
+        evaluate(m_nextInstant_ms);
+        m_nextInstant_ms += m_gridPeriod_ms;
+        evaluated++;
+    }
+
+    if (evaluated)
+    {
+        // keep the last sample before the next instant for the interpolation and forget
+        // about clients that went away.
+        for (auto it = m_trajectories.begin(); it != m_trajectories.end();)
+        {
+            QVector<Sample>& trajectory = *it;
+            while (trajectory.size() > 1 && trajectory.at(1).m_time_ms <= m_nextInstant_ms)
+            {
+                trajectory.removeFirst();
+            }
+            if (trajectory.last().m_time_ms + m_staleDevice_ms < time_ms)
+            {
+                it = m_trajectories.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    return evaluated;
+}
+
+
+bool SyncMatrix::interpolate(const QVector<Sample>& trajectory, int64_t time_ms, double& offset_us) const
+{
+    for (int i = 1; i < trajectory.size(); i++)
+    {
+        const Sample& before = trajectory.at(i - 1);
+        const Sample& after = trajectory.at(i);
+        if (before.m_time_ms <= time_ms && after.m_time_ms >= time_ms)
+        {
+            double fraction = after.m_time_ms == before.m_time_ms ?
+                        0.0 : double(time_ms - before.m_time_ms) / (after.m_time_ms - before.m_time_ms);
+            offset_us = before.m_offset_us + fraction * (after.m_offset_us - before.m_offset_us);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void SyncMatrix::evaluate(int64_t instant_ms)
+{
+    QVector<QString> ids;
+    QVector<double> offsets;
+
+    for (auto it = m_trajectories.constBegin(); it != m_trajectories.constEnd(); ++it)
+    {
+        double offset_us;
+        if (interpolate(*it, instant_ms, offset_us))
+        {
+            ids.append(it.key());
+            offsets.append(offset_us);
+        }
+    }
+
+    for (int a = 0; a < ids.size(); a++)
+    {
+        for (int b = a + 1; b < ids.size(); b++)
+        {
+            double diff_us = offsets.at(a) - offsets.at(b);
+            m_pairs[pairName(ids.at(a), ids.at(b))].add(diff_us);
+            m_largestDiff = std::max(m_largestDiff, std::fabs(diff_us));
+        }
+    }
+}
+
+
+QString SyncMatrix::pairName(const QString& a, const QString& b)
+{
+    return a < b ? a + "/" + b : b + "/" + a;
+}
+
+
+/// The largest aligned difference between any two clients since the last reset.
+///
+double SyncMatrix::getLargestDiff() const
+{
+    return m_largestDiff;
+}
+
+
+void SyncMatrix::resetLargestDiff()
+{
+    m_largestDiff = 0.0;
+}
+
+
+QJsonObject SyncMatrix::getJson() const
+{
+    QJsonArray pairs;
+    for (auto it = m_pairs.constBegin(); it != m_pairs.constEnd(); ++it)
+    {
+        QJsonObject pair;
+        pair["pair"] = it.key();
+        pair["count"] = QString::number(it->m_count);
+        pair["last"] = QString::number(it->m_last_us);
+        pair["p50"] = QString::number(it->m_p50.value());
+        pair["p95"] = QString::number(it->m_p95.value());
+        pair["p99"] = QString::number(it->m_p99.value());
+        pair["max"] = QString::number(it->m_max_us);
+        pairs.append(pair);
+    }
+
+    QJsonObject json;
+    json["name"] = "server";
+    json["command"] = "sync_matrix";
+    json["time"] = QString::number(m_nextInstant_ms - m_gridPeriod_ms);
+    json["pairs"] = pairs;
+    return json;
+}
+
+
+std::string SyncMatrix::getReport() const
+{
+    std::string report;
+    for (auto it = m_pairs.constBegin(); it != m_pairs.constEnd(); ++it)
+    {
+        report += fmt::format("{}{} p50.us={:.1f} p95.us={:.1f} p99.us={:.1f} max.us={:.1f}",
+                              report.empty() ? "" : " | ",
+                              it.key().toStdString(), it->m_p50.value(), it->m_p95.value(),
+                              it->m_p99.value(), it->m_max_us);
+    }
+    return report;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+#include <stdint.h>
+#include <string>
+
+
+/// Streaming quantile estimate using the P-square algorithm, i.e. without storing
+/// the observations.
+///
+class StreamingQuantile
+{
+public:
+    StreamingQuantile(double quantile = 0.5);
+
+    void add(double x);
+    double value() const;
+
+private:
+    double parabolic(int i, double d) const;
+    double linear(int i, int d) const;
+
+    double m_quantile;
+    int m_count = 0;
+    double m_heights[5];
+    double m_positions[5];
+    double m_desired[5];
+    double m_increments[5];
+};
+
+
+/// Statistics on the absolute time aligned offset difference between two clients.
+///
+struct PairStatistics
+{
+    PairStatistics();
+
+    void add(double diff_us);
+
+    int m_count = 0;
+    double m_last_us = 0.0;
+    double m_max_us = 0.0;
+    StreamingQuantile m_p50;
+    StreamingQuantile m_p95;
+    StreamingQuantile m_p99;
+};
+
+
+/// The offsets from the clients arrive at different times and rates. The offset trajectory
+/// for each client is linearly interpolated to common instants on a fixed grid and the
+/// pairwise differences are then evaluated at those instants. An instant is evaluated
+/// once the newest offset is a measurement period past it so that all clients had a
+/// chance to bracket it.
+///
+class SyncMatrix
+{
+public:
+    int add(const QString& id, int64_t time_ms, double offset_us);
+    double getLargestDiff() const;
+    void resetLargestDiff();
+    QJsonObject getJson() const;
+    std::string getReport() const;
+
+private:
+    struct Sample
+    {
+        int64_t m_time_ms;
+        double m_offset_us;
+    };
+
+    bool interpolate(const QVector<Sample>& trajectory, int64_t time_ms, double& offset_us) const;
+    void evaluate(int64_t instant_ms);
+    static QString pairName(const QString& a, const QString& b);
+
+    QMap<QString, QVector<Sample>> m_trajectories;
+    QMap<QString, PairStatistics> m_pairs;
+    int64_t m_nextInstant_ms = 0;
+    double m_largestDiff = 0.0;
+
+    const int64_t m_gridPeriod_ms = 10000;
+    const int64_t m_latency_ms = 90000;
+    const int64_t m_staleDevice_ms = 600000;
+};
@@ -11,55 +11,32 @@
 
 const int DELTAS_PER_HOUR = 4;
 
-void WS_ClientPeriodMeasurements::add(double offset_us)
+/// Since the clients deliver measurements at different rates the largest diff is taken
+/// from the time aligned sync matrix. Returns true when the matrix has new instants.
+///
+bool WS_Measurements::add(const QString &id, int64_t time_ms, double offset_us)
 {
-    m_offsets.push_back(offset_us);
-}
-
-// ---------------------------------------------------
-
-
-void WS_Measurements::add(const QString &id, double offset_us)
-{
-    m_lastPeriod[id].add(offset_us);
-
-    // since the clients might deliver measurements at different rates
-    // its easier to maintain the largest diff on the go.
-    double max = std::numeric_limits<double>::lowest();
-    double min = std::numeric_limits<double>::max();
-
-    for (const auto& period_measurement : m_lastPeriod)
-    {
-        const auto& offsets = period_measurement.m_offsets;
-        if (offsets.empty())
-        {
-            continue;
-        }
-        min = qMin(offsets.back(), min);
-        max = qMax(offsets.back(), max);
-    }
-
-    m_largestDiff = qMax(max - min, m_largestDiff);
+    return m_syncMatrix.add(id, time_ms, offset_us) > 0;
 }
 
 
 WebSocketJson WS_Measurements::finalizePeriod(int64_t msec)
 {
-    m_measurements.append({msec, m_largestDiff});
+    double largestDiff = m_syncMatrix.getLargestDiff();
+    m_measurements.append({msec, largestDiff});
 
     while (m_measurements.size() > HOURS_IN_WEEK * DELTAS_PER_HOUR)
     {
         m_measurements.removeFirst();
     }
 
-    m_largestDiff = std::numeric_limits<double>::lowest();
-    m_lastPeriod.clear();
+    m_syncMatrix.resetLargestDiff();
 
     auto json = new QJsonObject();
     (*json)["name"] = "server";
     (*json)["command"] = "max_delta_offset";
     (*json)["time"] = QString::number(msec);
-    (*json)["value"] = m_largestDiff;
+    (*json)["value"] = largestDiff;
 
     double mean_us = 0.0;
     double peak_us = 0.0;
@@ -142,12 +119,18 @@ WebSocket::~WebSocket()
 }
 
 
-void WebSocket::slotNewOffsetMeasurement(const QString &id, double offset_us, double mean_abs_dev, double rms)
+/// time_ms is when the offset was measured, i.e. the middle of the burst, which is what the
+/// sync matrix interpolates on. The offset arrives some time later.
+///
+void WebSocket::slotNewOffsetMeasurement(const QString &id, qint64 time_ms, double offset_us, double mean_abs_dev, double rms)
 {
-    m_longTermMeasurements.add(id, offset_us);
-
     int64_t now_ms = SystemTime::getWallClock_ns() / NS_IN_MSEC;
 
+    if (m_longTermMeasurements.add(id, time_ms, offset_us))
+    {
+        broadcast(QJsonDocument(m_longTermMeasurements.m_syncMatrix.getJson()).toJson());
+    }
+
     int64_t period = now_ms / (MSEC_IN_HOUR / DELTAS_PER_HOUR);
     if (period > m_period)
     {
@@ -292,6 +275,12 @@ void WebSocket::slotDisconnected()
 }
 
 
+const SyncMatrix& WebSocket::syncMatrix() const
+{
+    return m_longTermMeasurements.m_syncMatrix;
+}
+
+
 void WebSocket::transmit(const QJsonObject &json) /// fixit why slot ?
 {
     QJsonDocument doc(json);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "multicast.h"
+#include "syncmatrix.h"
 #include <QtWebSockets/QWebSocketServer>
 #include <QJsonObject>
 
@@ -10,21 +11,10 @@ using WebSocketJson = QSharedPointer<QJsonObject>;
 class QWebSocket;
 
 
-class WS_ClientPeriodMeasurements
-{
-public:
-    WS_ClientPeriodMeasurements() {}
-
-    void add(double offset_us);
-
-    QVector<double> m_offsets;
-};
-
-
 class WS_Measurements
 {
 public:
-    void add(const QString &id, double offset_us);
+    bool add(const QString &id, int64_t time_ms, double offset_us);
 
     WebSocketJson finalizePeriod(int64_t m_sec);
 
@@ -36,8 +26,7 @@ public:
         double m_value;
     };
 
-    double m_largestDiff = std::numeric_limits<double>::lowest();
-    QMap<QString, WS_ClientPeriodMeasurements> m_lastPeriod;
+    SyncMatrix m_syncMatrix;
     QVector<i_struct> m_measurements;
 };
 
@@ -50,9 +39,10 @@ public:
     WebSocket(uint16_t port);
     ~WebSocket();
 
-    void slotNewOffsetMeasurement(const QString& id, double offset_us, double mean_abs_dev, double rms);
+    void slotNewOffsetMeasurement(const QString& id, qint64 time_ms, double offset_us, double mean_abs_dev, double rms);
     void broadcast(const QByteArray &data);
     void transmit(const QJsonObject& json);
+    const SyncMatrix& syncMatrix() const;
 
 private:
     void sendWallOffset();
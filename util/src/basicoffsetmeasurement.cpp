@@ -9,20 +9,20 @@
 
 #include <cmath>
 #include <algorithm>
+#include <numeric>
 #include <ctime>
 
 extern int g_developmentMask;
 
 
 BasicMeasurementSeries::BasicMeasurementSeries(std::string logName, FilterType filterType)
-    : m_logName(logName),
-      m_filterType(filterType)
+    : m_logName(logName)
 {
-    if (m_filterType == DEFAULT)
+    if (filterType == DEFAULT)
     {
-        m_filterType = VCTCXO_MODE ? MeasurementSeriesBase::LARGEST_BIN_WINDOW : MeasurementSeriesBase::LARGEST_BIN_WINDOW;
+        filterType = VCTCXO_MODE ? MeasurementSeriesBase::LARGEST_BIN_WINDOW : MeasurementSeriesBase::LARGEST_BIN_WINDOW;
     }
-    trace->info("{} sample filtering algorithm is '{}'", m_logName, FilterAsString[m_filterType]);
+    setFiltering(filterType);
 }
 
 
@@ -43,216 +43,195 @@ void BasicMeasurementSeries::prepareNewDataMeasurement(int samples)
 }
 
 
-OffsetMeasurement::ResultCode BasicMeasurementSeries::accept(
-        size_t receivedSamples,
-        size_t filteredSamples,
-        double lossFailed, double lossWarn,
-        double filteredFailed, double filteredWarn)
+OffsetMeasurement BasicMeasurementSeries::calculate()
 {
-    double lost_pct = m_samples ? 100.0 - 100.0 * receivedSamples / m_samples : 0.0;
-    if (lost_pct > lossFailed)
+    // produce the difference vector between local time vs remote time
+    // ----------------------------------------------------------------
+    // a positive number means that the local time is ahead of the remote time
+    // and the ppm calculated elsewhere will be positive.
+
+    SampleList64 diff = MathFunc::diff(m_localTime, m_remoteTime);
+
+    if (g_developmentMask & DevelopmentMask::SaveMeasurements or
+            g_developmentMask & DevelopmentMask::SaveMeasurementsSingle)
     {
-        trace->warn("{}package loss is {:.1f}%, bailing out", m_logName, lost_pct);
-        return OffsetMeasurement::EXCESSIVE_PACKAGELOSS;
+        DataFiles::dumpVectors("/tmp/raw_clienttime_and_serverdelay", m_nofSeries, &m_localTime, &diff);
+        g_developmentMask &= ~DevelopmentMask::SaveMeasurementsSingle;
     }
-    if (lost_pct > lossWarn)
+
+    // run the filter pipeline, detrend -> window -> estimator -> acceptance
+    // ---------------------------------------------------------------------
+
+    FilterContext context;
+    context.m_logName = m_logName;
+    context.m_time = &m_localTime;
+    context.m_diff = std::move(diff);
+    context.m_samples = m_samples;
+    context.m_drift_ppm = m_drift_ppm;
+    context.m_pool = &m_pool;
+    context.m_window_ns = m_window_ns;
+
+    m_filter->apply(context);
+
+    diff = std::move(context.m_diff);
+    filtered_time = std::move(context.m_filteredTime);
+    filtered_diff = std::move(context.m_filteredDiff);
+    OffsetMeasurement::ResultCode resultCode = context.m_resultCode;
+
+    if (resultCode == OffsetMeasurement::PASS)
     {
-        trace->warn("{}package loss is {:.1f}%", m_logName, lost_pct);
+        updatePool(diff);
     }
 
-    double removed_pct = (100.0 * (receivedSamples - filteredSamples)) / receivedSamples;
-    if (removed_pct > filteredFailed)
+    if (resultCode != OffsetMeasurement::PASS && g_developmentMask & DevelopmentMask::SaveOnBailingOut)
     {
-        trace->warn("{}filtered out {:.1f}% samples, bailing out", m_logName, removed_pct);
-        return OffsetMeasurement::FILTER_ERROR;
+        DataFiles::dumpVectors("onbailingout_raw", m_nofSeries, &m_localTime, &diff);
+        DataFiles::dumpVectors("onbailingout_filtered", m_nofSeries, &filtered_time, &filtered_diff);
     }
-    if (removed_pct > filteredWarn)
+
+    OffsetMeasurement offsetMeasurement(m_nofSeries,
+                                        filtered_time.empty() ? 0 : filtered_time.front(),
+                                        filtered_time.empty() ? 0 : filtered_time.back(),
+                                        m_measurementRun,
+                                        m_localTime.size(),
+                                        context.m_usedSamples,
+                                        context.m_offset_ns,
+                                        resultCode);
+    if (!diff.empty())
     {
-        trace->warn("{}filtered out {:.1f}% samples", m_logName, removed_pct);
+        offsetMeasurement.m_spread_ns = MathFunc::standardDeviation(filtered_diff.empty() ? diff : filtered_diff);
     }
 
-    return OffsetMeasurement::PASS;
+    return offsetMeasurement;
 }
 
 
-OffsetMeasurement::ResultCode BasicMeasurementSeries::filterMeasurementsInRange(
-        const SampleList64& time,
-        const SampleList64& diff,
-        SampleList64 &filtered_time,
-        SampleList64 &filtered_diff,
-        int64_t lower_limit,
-        int64_t upper_limit,
-        int64_t &average)
+// development
+void BasicMeasurementSeries::setFiltering(BasicMeasurementSeries::FilterType filterType)
 {
-    if (time.empty())
-    {
-        trace->error("{}fatal error in filterMeasurements: no data recieved", m_logName);
-        return OffsetMeasurement::NO_DATA;
-    }
-
-    for (size_t i = 0; i < time.size(); i++)
-    {
-        if (diff.at(i) >= lower_limit && diff.at(i) <= upper_limit)
-        {
-            filtered_diff.push_back(diff.at(i));
-            filtered_time.push_back(time.at(i));
-        }
-    }
-    average = MathFunc::average(filtered_diff);
-    return OffsetMeasurement::PASS;
+    setFiltering(FilterAsString[filterType]);
 }
 
 
-int64_t BasicMeasurementSeries::averageFromLargestHistogramBin(const SampleList64 &_x,
-                                                               size_t nofBins,
-                                                               int histogramRange_ns)
+/// Select one of the pipelines from SampleFilter::names(). Returns false and keeps the
+/// current filter if the name is unknown.
+///
+bool BasicMeasurementSeries::setFiltering(const std::string& filterName)
 {
-    SampleList32 m_bins;
-    m_bins.assign(nofBins, 0);
-
-    int64_t bin_width_ns = histogramRange_ns / nofBins;
-    int64_t lower = MathFunc::min(_x);
-    int largest_value = 0;
-    uint largest_index = 0;
-    for (auto x : _x)
+    SampleFilter* filter = SampleFilter::create(filterName);
+    if (!filter)
     {
-        uint index = (x - lower) / bin_width_ns;
-        if (index < nofBins)
-        {
-            m_bins[index]++;
-            if (m_bins[index] > largest_value)
-            {
-                largest_index = index;
-                largest_value = m_bins[index];
-            }
-            else if (m_bins[index] == largest_value and index < largest_index)
-            {
-                largest_index = index;
-            }
-        }
-    }
-
-    if (largest_value <= 4)
-    {
-        trace->warn("largest histogram average bin contains only {} samples", largest_value);
+        trace->error("{} unknown sample filter '{}'", m_logName, filterName);
+        return false;
     }
+    m_filter.reset(filter);
+    trace->info("{} sample filtering algorithm is '{}'", m_logName, filterName);
+    return true;
+}
 
-    double correction = 0.0;
-    if (largest_value > 0 and largest_index > 0 and largest_index < m_bins.size() - 1)
-    {
-        double lo_loss = (largest_value - m_bins[largest_index-1]) / ((double) largest_value);
-        double hi_loss = (largest_value - m_bins[largest_index+1]) / ((double) largest_value);
-        correction = (lo_loss - hi_loss) / 2.0;
-    }
 
-    return lower + largest_index * bin_width_ns + bin_width_ns / 2 + correction * bin_width_ns;
+std::string BasicMeasurementSeries::getFilterName() const
+{
+    return m_filter->name();
 }
 
 
-OffsetMeasurement BasicMeasurementSeries::calculate()
+/// The current drift between local and remote time, positive if the local time runs fast.
+/// This will be the slope from OffsetMeasurementHistory::getPPM().
+///
+void BasicMeasurementSeries::setDriftEstimate(double ppm)
 {
-    // produce the difference vector between local time vs remote time
-    // ----------------------------------------------------------------
-    // a positive number means that the local time is ahead of the remote time
-    // and the ppm calculated elsewhere will be positive.
+    m_drift_ppm = ppm;
+}
 
-    SampleList64 diff = MathFunc::diff(m_localTime, m_remoteTime);
 
-    if (g_developmentMask & DevelopmentMask::SaveMeasurements or
-            g_developmentMask & DevelopmentMask::SaveMeasurementsSingle)
+/// Keep the lowest samples of the (detrended) burst for the pooled filter.
+///
+void BasicMeasurementSeries::updatePool(const SampleList64 &diff)
+{
+    if (diff.empty())
     {
-        DataFiles::dumpVectors("/tmp/raw_clienttime_and_serverdelay", m_nofSeries, &m_localTime, &diff);
-        g_developmentMask &= ~DevelopmentMask::SaveMeasurementsSingle;
+        return;
     }
 
-    // sanitize the measurements. Remove the worst outliers
-    // ----------------------------------------------------
+    PooledBurst burst;
+    burst.m_midpoint_ns = m_localTime.front() + (m_localTime.back() - m_localTime.front()) / 2;
+    burst.m_diff = diff;
 
-    filtered_time.clear();
-    filtered_diff.clear();
-    int64_t average_offset_ns = 0.0;
-    OffsetMeasurement::ResultCode resultCode = OffsetMeasurement::PASS;
-    size_t filtered_samples_size = 0;
+    size_t keep = std::min(PooledLowestWindow::poolSamples, diff.size());
+    std::nth_element(burst.m_diff.begin(), burst.m_diff.begin() + keep - 1, burst.m_diff.end());
+    burst.m_diff.resize(keep);
 
-    switch (m_filterType)
+    m_pool.push_back(burst);
+    while (m_pool.size() > m_poolBursts)
     {
-    case DEFAULT:
-    {
-        trace->critical("can't apply default filter..");
-        resultCode = OffsetMeasurement::INTERNALERROR;
-        break;
+        m_pool.pop_front();
     }
-    case EVERYTHING:
-    {
-        filtered_samples_size = diff.size();
-        average_offset_ns = MathFunc::average(diff);
-        break;
-    }
-    case LOWEST_VALUES:
+}
+
+
+/// The pooled samples are useless once the clock has been stepped.
+///
+void BasicMeasurementSeries::clearPool()
+{
+    m_pool.clear();
+}
+
+
+/// The pooled samples are projected to the current burst with the drift estimate, which
+/// doesn't know about a ppm adjustment applied at at_ns in between. The pool is cleared if
+/// that would put the oldest pooled burst off by more than the tolerance.
+///
+void BasicMeasurementSeries::ppmAdjusted(double ppm, int64_t at_ns)
+{
+    if (m_pool.empty())
     {
-        const int range = 600000;
-        int64_t minimum = MathFunc::min(diff);
-        int64_t maximum = minimum + range;
-        resultCode = filterMeasurementsInRange(
-                    m_localTime, diff,
-                    filtered_time, filtered_diff,
-                    minimum, maximum,
-                    average_offset_ns);
-        if (resultCode == OffsetMeasurement::PASS)
-        {
-            resultCode = accept(diff.size(), filtered_diff.size(), 50.0, 10.0, 80.0, 50.0);
-        }
-
-        filtered_samples_size = filtered_time.size();
-        break;
+        return;
     }
-    case LARGEST_BIN_WINDOW:
+    double error_ns = std::fabs(ppm) * (at_ns - m_pool.front().m_midpoint_ns) / 1000000.0;
+    if (error_ns > m_poolTolerance_ns)
     {
-        auto av = averageFromLargestHistogramBin(diff, 100, 1000000);
-        int64_t minimum = av - 300000;
-        int64_t maximum = av + 110000;
-
-        SampleList64 new_diff;
-        SampleList64 time;
-
-        resultCode = filterMeasurementsInRange(
-                         m_localTime, diff,
-                         filtered_time, filtered_diff,
-                         minimum, maximum,
-                         average_offset_ns);
-
-        if (resultCode == OffsetMeasurement::PASS)
-        {
-            resultCode = accept(diff.size(), filtered_diff.size(), 50.0, 10.0, 70.0, 50.0);
-        }
-
-        filtered_samples_size = filtered_time.size();
-        break;
-    }
+        trace->debug("{}ppm adjustment {:.3f} clears the sample pool", m_logName, ppm);
+        m_pool.clear();
     }
+}
 
-    if (resultCode != OffsetMeasurement::PASS && g_developmentMask & DevelopmentMask::SaveOnBailingOut)
-    {
-        DataFiles::dumpVectors("onbailingout_raw", m_nofSeries, &m_localTime, &diff);
-        DataFiles::dumpVectors("onbailingout_filtered", m_nofSeries, &filtered_time, &filtered_diff);
-    }
 
-    OffsetMeasurement offsetMeasurement(m_nofSeries,
-                                        filtered_time.front(), filtered_time.back(),
-                                        m_measurementRun,
-                                        m_localTime.size(),
-                                        filtered_samples_size,
-                                        average_offset_ns,
-                                        resultCode);
+/// A copy of the current burst as it will be seen by calculate(), i.e. this must be
+/// called before calculate() in order to get the pool without the current burst.
+///
+FilterInput BasicMeasurementSeries::getFilterInput() const
+{
+    FilterInput input;
+    input.m_logName = m_logName;
+    input.m_time = m_localTime;
+    input.m_diff = MathFunc::diff(m_localTime, m_remoteTime);
+    input.m_samples = m_samples;
+    input.m_drift_ppm = m_drift_ppm;
+    input.m_pool = m_pool;
+    input.m_window_ns = m_window_ns;
+    return input;
+}
 
-    return offsetMeasurement;
+
+/// Window width for the window stages that have a fixed width, e.g. as sized by a probe
+/// of the channel. 0 restores the stage defaults.
+///
+void BasicMeasurementSeries::setWindow_ns(int64_t window_ns)
+{
+    m_window_ns = window_ns;
 }
 
 
-// development
-void BasicMeasurementSeries::setFiltering(BasicMeasurementSeries::FilterType filterType)
+const SampleList64& BasicMeasurementSeries::getRemoteTime() const
+{
+    return m_remoteTime;
+}
+
+
+const SampleList64& BasicMeasurementSeries::getLocalTime() const
 {
-    m_filterType = filterType;
+    return m_localTime;
 }
 
 
@@ -2,6 +2,10 @@
 
 #include "mathfunc.h"
 #include "measurementseriesbase.h"
+#include "filterpipeline.h"
+
+#include <deque>
+#include <memory>
 
 
 class BasicMeasurementSeries : public MeasurementSeriesBase
@@ -13,28 +17,21 @@ public:
     void prepareNewDataMeasurement(int samples) override;
     OffsetMeasurement calculate() override;
     void setFiltering(BasicMeasurementSeries::FilterType filterType) override;
+    bool setFiltering(const std::string& filterName) override;
+    std::string getFilterName() const override;
+    void setDriftEstimate(double ppm) override;
+    void setWindow_ns(int64_t window_ns) override;
+    void clearPool() override;
+    void ppmAdjusted(double ppm, int64_t at_ns) override;
+    FilterInput getFilterInput() const override;
+    const SampleList64& getRemoteTime() const override;
+    const SampleList64& getLocalTime() const override;
 
     void saveRawMeasurements(std::string filename, int serial) const override;
     void saveFilteredMeasurements(std::string filename, int serial) const override;
 
 private:
-    OffsetMeasurement::ResultCode filterMeasurementsInRange(
-            const SampleList64 &time, const SampleList64 &diff,
-            SampleList64 &filtered_time, SampleList64 &filtered_diff,
-            int64_t lowerLimit, int64_t upperLimit,
-            int64_t &average);
-
-    int64_t averageFromLargestHistogramBin(
-            const SampleList64 &_x,
-            size_t nofBins,
-            int histogramRange_ns);
-
-    OffsetMeasurement::ResultCode accept(
-            size_t receivedSamples,
-            size_t filteredSamples,
-            double lossFailed,
-            double lossWarn,
-            double filteredFailed, double filteredWarn);
+    void updatePool(const SampleList64 &diff);
 
     std::string m_logName;
     SampleList64 m_remoteTime;
@@ -42,7 +39,15 @@ private:
 
     SampleList64 filtered_time, filtered_diff;
 
-    FilterType m_filterType;
+    std::unique_ptr<SampleFilter> m_filter;
+    double m_drift_ppm = 0.0;
+    int64_t m_window_ns = 0;
+
+    // the best samples from the previous bursts for the pooled filter
+    std::deque<PooledBurst> m_pool;
+    const size_t m_poolBursts = 4;
+    // the largest error a ppm adjustment may cause in the projection of a pooled burst
+    const double m_poolTolerance_ns = 1000.0;
 
     int m_nofSeries = 1;
     size_t m_measurementRun = 0;
@@ -0,0 +1,322 @@
+#include "clockservo.h"
+#include "log.h"
+#include "spdlog/fmt/fmt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+const std::vector<std::string> ClockServo::ServoAsString = {
+    "default", "pi", "deadband"};
+
+
+bool ServoParameters::set(const std::string& key, double value)
+{
+    if (key == "zero") zero = value;
+    else if (key == "antislope") antislope = value;
+    else if (key == "hilockthrottle") hiLockThrottle = value;
+    else if (key == "lockthrottle") lockThrottle = value;
+    else if (key == "kp") kp = value;
+    else if (key == "ki") ki = value;
+    else if (key == "integrallimit") integralLimit_ppm = value;
+    else if (key == "deadband") deadband_us = value;
+    else if (key == "maxstep") maxStep_ppm = value;
+    else if (key == "maxsteplocked") maxStepLocked_ppm = value;
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+
+/// Parse a comma separated list of key=value pairs, e.g. "kp=0.002,ki=0.00001"
+///
+bool ServoParameters::parse(const std::string& keyValues)
+{
+    std::istringstream stream(keyValues);
+    std::string keyValue;
+    bool success = true;
+
+    while (std::getline(stream, keyValue, ','))
+    {
+        size_t separator = keyValue.find('=');
+        if (separator == std::string::npos)
+        {
+            trace->warn("servo parameter '{}' is not a key=value pair", keyValue);
+            success = false;
+            continue;
+        }
+        std::string key = keyValue.substr(0, separator);
+        try
+        {
+            double value = std::stod(keyValue.substr(separator + 1));
+            if (!set(key, value))
+            {
+                trace->warn("unknown servo parameter '{}'", key);
+                success = false;
+            }
+        }
+        catch (const std::exception&)
+        {
+            trace->warn("invalid value for servo parameter '{}'", key);
+            success = false;
+        }
+    }
+    return success;
+}
+
+
+std::string ServoParameters::toString() const
+{
+    return fmt::format("zero={} antislope={} hilockthrottle={} lockthrottle={} kp={} ki={} integrallimit={} "
+                       "deadband={} maxstep={} maxsteplocked={}",
+                       zero, antislope, hiLockThrottle, lockThrottle, kp, ki, integralLimit_ppm,
+                       deadband_us, maxStep_ppm, maxStepLocked_ppm);
+}
+
+// -------------------------------------------
+
+
+ClockServo::ClockServo(const std::string& logName, const ServoParameters& parameters)
+    : m_logName(logName),
+      m_parameters(parameters)
+{
+}
+
+
+ClockServo* ClockServo::create(ServoType servoType, const std::string& logName, const ServoParameters& parameters)
+{
+    trace->info("{}clock servo is '{}'", logName, ServoAsString[servoType]);
+
+    switch (servoType)
+    {
+    case PROPORTIONAL_INTEGRAL:
+        return new PIServo(logName, parameters);
+    case DEADBAND:
+        return new DeadbandServo(logName, parameters);
+    case DEFAULT:
+        break;
+    }
+    return new DefaultServo(logName, parameters);
+}
+
+
+bool ClockServo::fromString(const std::string& name, ServoType& servoType)
+{
+    for (size_t i = 0; i < ServoAsString.size(); i++)
+    {
+        if (ServoAsString[i] == name)
+        {
+            servoType = static_cast<ServoType>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void ClockServo::setParameters(const ServoParameters& parameters)
+{
+    m_parameters = parameters;
+}
+
+
+const ServoParameters& ClockServo::parameters() const
+{
+    return m_parameters;
+}
+
+
+std::string ClockServo::name() const
+{
+    return ServoAsString[type()];
+}
+
+
+void ClockServo::reset()
+{
+    m_output_ppm = 0.0;
+}
+
+
+double ClockServo::output_ppm() const
+{
+    return m_output_ppm;
+}
+
+
+void ClockServo::setOutput_ppm(double ppm)
+{
+    m_output_ppm = ppm;
+}
+
+
+double ClockServo::limit(double ppm, bool locked) const
+{
+    double ppmLimit = locked ? m_parameters.maxStepLocked_ppm : m_parameters.maxStep_ppm;
+
+    if (std::fabs(ppm) > ppmLimit)
+    {
+        double newppm = ppm >= ppmLimit ? ppmLimit : -ppmLimit;
+        trace->warn("{}large ppm adjustment value {} truncated to {}", m_logName, ppm, newppm);
+        return newppm;
+    }
+    return ppm;
+}
+
+// -------------------------------------------
+
+
+DefaultServo::DefaultServo(const std::string& logName, const ServoParameters& parameters)
+    : ClockServo(logName, parameters)
+{
+}
+
+
+double DefaultServo::adjust(const ServoInput& input)
+{
+    double zero = m_parameters.zero;
+
+    bool zero_crossing = input.offset_us * input.previousOffset_us < 0.0;
+    if (!zero_crossing and std::fabs(input.offset_us) < std::fabs(input.previousOffset_us))
+    {
+        zero *= 4;
+    }
+
+    double offset_ppm = - input.offset_us / zero;
+    double levelling_ppm = - (input.offset_us - input.previousOffset_us) /
+                           (input.deltaTime_sec * m_parameters.antislope);
+
+    double ppm = offset_ppm + levelling_ppm;
+
+    if (input.hiLocked)
+    {
+        ppm /= m_parameters.hiLockThrottle;
+    }
+    else if (input.locked)
+    {
+        ppm /= m_parameters.lockThrottle;
+    }
+
+    trace->debug("{}adjusting ppm {:7.3f} (offset {:7.3f} levelling {:7.3f})",
+                 m_logName, ppm, offset_ppm, levelling_ppm);
+
+    ppm = limit(ppm, input.locked);
+    m_output_ppm += ppm;
+    return ppm;
+}
+
+// -------------------------------------------
+
+
+PIServo::PIServo(const std::string& logName, const ServoParameters& parameters)
+    : ClockServo(logName, parameters)
+{
+}
+
+
+/// The PI servo works out the total frequency correction it wants the client to run with
+/// and returns the difference to what it asked for last time. Anti-windup is done by clamping
+/// the integral term and by not integrating when the step had to be truncated.
+///
+double PIServo::adjust(const ServoInput& input)
+{
+    double integration = input.offset_us * input.deltaTime_sec;
+    m_integral += integration;
+
+    if (m_parameters.ki > 0.0)
+    {
+        double integralLimit = m_parameters.integralLimit_ppm / m_parameters.ki;
+        m_integral = std::max(-integralLimit, std::min(m_integral, integralLimit));
+    }
+
+    double proportional_ppm = - m_parameters.kp * input.offset_us;
+    double integral_ppm = - m_parameters.ki * m_integral;
+    double wanted_ppm = proportional_ppm + integral_ppm;
+
+    double ppm = limit(wanted_ppm - m_output_ppm, input.locked);
+    if (ppm != wanted_ppm - m_output_ppm)
+    {
+        m_integral -= integration;
+    }
+    m_output_ppm += ppm;
+
+    trace->debug("{}adjusting ppm {:7.3f} (proportional {:7.3f} integral {:7.3f})",
+                 m_logName, ppm, proportional_ppm, integral_ppm);
+
+    return ppm;
+}
+
+
+void PIServo::reset()
+{
+    ClockServo::reset();
+    m_integral = 0.0;
+}
+
+
+/// Preloads the integral with the correction so that the servo holds it, rather than asking
+/// for the whole correction back on its first adjustment.
+///
+void PIServo::setOutput_ppm(double ppm)
+{
+    ClockServo::setOutput_ppm(ppm);
+    m_integral = m_parameters.ki > 0.0 ? - ppm / m_parameters.ki : 0.0;
+}
+
+
+std::vector<double> PIServo::getState() const
+{
+    return {m_integral, m_output_ppm};
+}
+
+
+void PIServo::setState(const std::vector<double>& state)
+{
+    if (state.size() == 2)
+    {
+        m_integral = state[0];
+        m_output_ppm = state[1];
+    }
+}
+
+// -------------------------------------------
+
+
+DeadbandServo::DeadbandServo(const std::string& logName, const ServoParameters& parameters)
+    : ClockServo(logName, parameters)
+{
+}
+
+
+/// Leaves the client frequency alone as long as the offset stays inside the deadband.
+/// Outside it the excess offset is corrected proportionally and half of the observed
+/// drift is taken out as well.
+///
+double DeadbandServo::adjust(const ServoInput& input)
+{
+    double excess_us = std::fabs(input.offset_us) - m_parameters.deadband_us;
+
+    if (excess_us <= 0.0)
+    {
+        trace->debug("{}offset {:.1f} us inside deadband, no adjustment", m_logName, input.offset_us);
+        return 0.0;
+    }
+
+    double offset_ppm = - m_parameters.kp * std::copysign(excess_us, input.offset_us);
+    double levelling_ppm = 0.0;
+    if (input.deltaTime_sec > 0.0)
+    {
+        levelling_ppm = - 0.5 * (input.offset_us - input.previousOffset_us) / input.deltaTime_sec;
+    }
+
+    double ppm = offset_ppm + levelling_ppm;
+
+    trace->debug("{}adjusting ppm {:7.3f} (offset {:7.3f} levelling {:7.3f})",
+                 m_logName, ppm, offset_ppm, levelling_ppm);
+
+    ppm = limit(ppm, input.locked);
+    m_output_ppm += ppm;
+    return ppm;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "globals.h"
+
+#include <string>
+#include <vector>
+
+/// The tunables for all the servos. Each device owns its own set so that e.g. the gains
+/// can be changed for a single client at runtime with the control application.
+///
+struct ServoParameters
+{
+    // default servo, experimental constants galore.
+#ifdef VCTCXO
+    double zero = 330;
+    double antislope = 9;
+    double hiLockThrottle = 1.25;
+    double lockThrottle = 1.25;
+#else
+    double zero = 400;
+    double antislope = 500000;
+    double hiLockThrottle = 4;
+    double lockThrottle = 2;
+#endif
+
+    // pi servo. kp is ppm per us offset, ki is ppm per us offset accumulated over a second.
+    double kp = 1.0 / 400.0;
+    double ki = 1.0 / 50000.0;
+    double integralLimit_ppm = 1.0;
+
+    // deadband servo. Offsets inside the deadband are left alone.
+    double deadband_us = 10.0;
+
+    // the largest adjustment sent to a client in a single go
+    double maxStep_ppm = 0.2;
+    double maxStepLocked_ppm = 0.1;
+
+    bool set(const std::string& key, double value);
+    bool parse(const std::string& keyValues);
+    std::string toString() const;
+};
+
+
+/// What a servo gets to see after each measurement.
+///
+struct ServoInput
+{
+    double offset_us = 0.0;
+    double previousOffset_us = 0.0;
+    double deltaTime_sec = 0.0;
+    bool locked = false;
+    bool hiLocked = false;
+};
+
+
+/// A clock servo converts the measured client offsets into relative ppm adjustments
+/// for the client. The returned value is added to whatever ppm the client is already
+/// running with.
+///
+class ClockServo
+{
+public:
+    enum ServoType
+    {
+        DEFAULT,                // the original hand tuned servo
+        PROPORTIONAL_INTEGRAL,  // classic PI with anti-windup
+        DEADBAND                // holds the frequency as long as the offset stays inside a deadband
+    };
+
+    static const std::vector<std::string> ServoAsString;
+
+    ClockServo(const std::string& logName, const ServoParameters& parameters);
+    virtual ~ClockServo() {}
+
+    static ClockServo* create(ServoType servoType,
+                              const std::string& logName,
+                              const ServoParameters& parameters = ServoParameters());
+    static bool fromString(const std::string& name, ServoType& servoType);
+
+    virtual ServoType type() const = 0;
+    virtual double adjust(const ServoInput& input) = 0;
+    virtual void reset();
+    // the total correction returned since the last reset. A servo taking over at runtime
+    // starts from the correction of the servo it replaces rather than from zero.
+    double output_ppm() const;
+    virtual void setOutput_ppm(double ppm);
+    // the internal state, for restoring a servo after a restart, see DriftState
+    virtual std::vector<double> getState() const { return {}; }
+    virtual void setState(const std::vector<double>& /*state*/) {}
+
+    void setParameters(const ServoParameters& parameters);
+    const ServoParameters& parameters() const;
+    std::string name() const;
+
+protected:
+    double limit(double ppm, bool locked) const;
+
+    std::string m_logName;
+    ServoParameters m_parameters;
+    double m_output_ppm = 0.0;
+};
+
+
+class DefaultServo : public ClockServo
+{
+public:
+    DefaultServo(const std::string& logName, const ServoParameters& parameters);
+
+    ServoType type() const override { return DEFAULT; }
+    double adjust(const ServoInput& input) override;
+};
+
+
+class PIServo : public ClockServo
+{
+public:
+    PIServo(const std::string& logName, const ServoParameters& parameters);
+
+    ServoType type() const override { return PROPORTIONAL_INTEGRAL; }
+    double adjust(const ServoInput& input) override;
+    void reset() override;
+    void setOutput_ppm(double ppm) override;
+    std::vector<double> getState() const override;
+    void setState(const std::vector<double>& state) override;
+
+private:
+    double m_integral = 0.0;
+};
+
+
+class DeadbandServo : public ClockServo
+{
+public:
+    DeadbandServo(const std::string& logName, const ServoParameters& parameters);
+
+    ServoType type() const override { return DEADBAND; }
+    double adjust(const ServoInput& input) override;
+};
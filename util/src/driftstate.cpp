@@ -0,0 +1,101 @@
+#include "driftstate.h"
+#include "globals.h"
+#include "log.h"
+#include "systemtime.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+
+
+DriftState DriftState::load(const QString& name)
+{
+    DriftState state;
+
+    QFile file(fileName(name));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        trace->info("no saved drift state for {}", name.toStdString());
+        return state;
+    }
+
+    QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+    if (json.value("saved").toString().isEmpty())
+    {
+        trace->warn("invalid drift state in {}", fileName(name).toStdString());
+        return state;
+    }
+
+    state.m_saved_ns = json.value("saved").toString().toLongLong();
+    state.m_ppm = json.value("ppm").toString().toDouble();
+    state.m_ppmTrend = json.value("ppm_trend").toString().toDouble();
+    state.m_wander_ppm = json.value("wander").toString().toDouble();
+    state.m_temperature = json.value("temperature").toString().toDouble();
+    state.m_lockQuality = json.value("lock_quality").toString().toInt();
+    state.m_servo = json.value("servo").toString().toStdString();
+    for (const QString& value : json.value("servo_state").toString().split(",", QString::SkipEmptyParts))
+    {
+        state.m_servoState.push_back(value.toDouble());
+    }
+    state.m_delaySpread_ns = json.value("delay_spread").toString().toDouble();
+    state.m_probeSpread_ns = json.value("probe_spread").toString().toDouble();
+    state.m_valid = true;
+
+    trace->info("loaded drift state for {}, {}", name.toStdString(), state.toString());
+    return state;
+}
+
+
+bool DriftState::save(const QString& name) const
+{
+    QStringList servoState;
+    for (double value : m_servoState)
+    {
+        servoState.append(QString::number(value, 'g', 12));
+    }
+
+    QJsonObject json;
+    json["saved"] = QString::number(m_saved_ns);
+    json["ppm"] = QString::number(m_ppm, 'g', 12);
+    json["ppm_trend"] = QString::number(m_ppmTrend, 'g', 12);
+    json["wander"] = QString::number(m_wander_ppm);
+    json["temperature"] = QString::number(m_temperature);
+    json["lock_quality"] = QString::number(m_lockQuality);
+    json["servo"] = QString::fromStdString(m_servo);
+    json["servo_state"] = servoState.join(",");
+    json["delay_spread"] = QString::number(m_delaySpread_ns);
+    json["probe_spread"] = QString::number(m_probeSpread_ns);
+
+    QFile file(fileName(name));
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        trace->warn("couldn't save drift state to {}", fileName(name).toStdString());
+        return false;
+    }
+    file.write(QJsonDocument(json).toJson());
+    trace->debug("saved drift state for {}, {}", name.toStdString(), toString());
+    return true;
+}
+
+
+double DriftState::age_hours() const
+{
+    return (SystemTime::getWallClock_ns() - m_saved_ns) / NS_IN_SEC_F / 3600.0;
+}
+
+
+std::string DriftState::toString() const
+{
+    return fmt::format("age {:.1f} hours, ppm {:.3f}, trend {:.4f} ppm/h, wander {:.3f} ppm, "
+                       "temperature {:.1f}, lock quality {}, delay spread {:.1f} us",
+                       age_hours(), m_ppm, m_ppmTrend, m_wander_ppm,
+                       m_temperature, m_lockQuality, m_delaySpread_ns / 1000.0);
+}
+
+
+QString DriftState::fileName(const QString& name)
+{
+    return QCoreApplication::applicationDirPath() + "/" + name + ".state";
+}
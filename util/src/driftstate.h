@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QString>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/// Clock state persisted per host so that a restarted client is back in lock after a burst
+/// or two rather than going through the full initialization. The client saves its own
+/// frequency (the software ppm, its trend and the temperature it was measured at) and the
+/// server saves what it knows about each client (lock quality, servo state, delay estimates).
+/// The state is a json file next to the executable, like default.dac.
+///
+struct DriftState
+{
+    bool m_valid = false;
+    // wall clock at the time of saving
+    int64_t m_saved_ns = 0;
+
+    // client
+    double m_ppm = 0.0;
+    // ppm change per hour
+    double m_ppmTrend = 0.0;
+    double m_wander_ppm = 0.0;
+    double m_temperature = 0.0;
+
+    // server
+    int m_lockQuality = 0;
+    std::string m_servo;
+    std::vector<double> m_servoState;
+    double m_delaySpread_ns = 0.0;
+    double m_probeSpread_ns = 0.0;
+
+    static DriftState load(const QString& name);
+    bool save(const QString& name) const;
+    double age_hours() const;
+    std::string toString() const;
+
+private:
+    static QString fileName(const QString& name);
+};
@@ -0,0 +1,194 @@
+#include "filterpipeline.h"
+
+#include <algorithm>
+#include <numeric>
+
+
+// The pipeline definitions shared by server, client and dataanalysis. A new filter is
+// a new line here with the stages it wants.
+//
+typedef FilterPipeline<Detrend, AllSamples, Mean, AcceptAll> Everything;
+typedef FilterPipeline<Detrend, LowestWindow, Mean, AcceptLoss<50, 10, 80, 50>> LowestValues;
+typedef FilterPipeline<Detrend, LargestBinWindow, Mean, AcceptLoss<50, 10, 70, 50>> LargestBinMean;
+typedef FilterPipeline<Detrend, PercentileWindow, LowPercentile, AcceptConfidence<50, 10, 200000>> LowPercentileFilter;
+typedef FilterPipeline<Detrend, KernelDensityWindow, WindowLocation, AcceptLoss<50, 10, 70, 50>> KernelDensityMode;
+typedef FilterPipeline<Detrend, PooledLowestWindow, WindowLocation, AcceptLoss<50, 10, 100, 100>> PooledLowest;
+
+
+const int64_t LowestWindow::range;
+const size_t LargestBinWindow::nofBins;
+const int LargestBinWindow::histogramRange_ns;
+const int64_t LargestBinWindow::lowerWindow_ns;
+const int64_t LargestBinWindow::upperWindow_ns;
+const int PercentileWindow::percentile;
+const int PercentileWindow::bootstrapResamples;
+const size_t PooledLowestWindow::poolSamples;
+
+
+SampleFilter* SampleFilter::create(const std::string& name)
+{
+    if (name == "everything") return new Everything(name);
+    if (name == "lowest values") return new LowestValues(name);
+    if (name == "largest bin window") return new LargestBinMean(name);
+    if (name == "low percentile") return new LowPercentileFilter(name);
+    if (name == "kernel density mode") return new KernelDensityMode(name);
+    if (name == "pooled lowest") return new PooledLowest(name);
+    return nullptr;
+}
+
+
+std::vector<std::string> SampleFilter::names()
+{
+    return {"everything", "lowest values", "largest bin window", "low percentile",
+            "kernel density mode", "pooled lowest"};
+}
+
+
+FilterContext FilterInput::context() const
+{
+    FilterContext context;
+    context.m_logName = m_logName;
+    context.m_time = &m_time;
+    context.m_diff = m_diff;
+    context.m_samples = m_samples;
+    context.m_drift_ppm = m_drift_ppm;
+    context.m_pool = &m_pool;
+    context.m_window_ns = m_window_ns;
+    return context;
+}
+
+
+void FilterContext::selectRange(int64_t lower, int64_t upper)
+{
+    for (size_t i = 0; i < m_diff.size(); i++)
+    {
+        if (m_diff[i] >= lower && m_diff[i] <= upper)
+        {
+            m_filteredDiff.push_back(m_diff[i]);
+            m_filteredTime.push_back(m_time->at(i));
+        }
+    }
+}
+
+
+bool acceptLoss(FilterContext& context,
+                double lossFailed, double lossWarn,
+                double filteredFailed, double filteredWarn)
+{
+    size_t receivedSamples = context.m_diff.size();
+    size_t filteredSamples = context.m_filteredDiff.size();
+
+    double lost_pct = context.m_samples ? 100.0 - 100.0 * receivedSamples / context.m_samples : 0.0;
+    if (lost_pct > lossFailed)
+    {
+        trace->warn("{}package loss is {:.1f}%, bailing out", context.m_logName, lost_pct);
+        context.m_resultCode = OffsetMeasurement::EXCESSIVE_PACKAGELOSS;
+        return false;
+    }
+    if (lost_pct > lossWarn)
+    {
+        trace->warn("{}package loss is {:.1f}%", context.m_logName, lost_pct);
+    }
+
+    double removed_pct = (100.0 * (receivedSamples - filteredSamples)) / receivedSamples;
+    if (removed_pct > filteredFailed)
+    {
+        trace->warn("{}filtered out {:.1f}% samples, bailing out", context.m_logName, removed_pct);
+        context.m_resultCode = OffsetMeasurement::FILTER_ERROR;
+        return false;
+    }
+    if (removed_pct > filteredWarn)
+    {
+        trace->warn("{}filtered out {:.1f}% samples", context.m_logName, removed_pct);
+    }
+
+    return true;
+}
+
+
+void LargestBinWindow::run(FilterContext& context)
+{
+    const SampleList64& diff = context.m_diff;
+    SampleList32 bins;
+    bins.assign(nofBins, 0);
+
+    int64_t bin_width_ns = histogramRange_ns / nofBins;
+    int64_t lower = MathFunc::min(diff);
+    int largest_value = 0;
+    uint largest_index = 0;
+    for (auto x : diff)
+    {
+        uint index = (x - lower) / bin_width_ns;
+        if (index < nofBins)
+        {
+            bins[index]++;
+            if (bins[index] > largest_value)
+            {
+                largest_index = index;
+                largest_value = bins[index];
+            }
+            else if (bins[index] == largest_value and index < largest_index)
+            {
+                largest_index = index;
+            }
+        }
+    }
+
+    if (largest_value <= 4)
+    {
+        trace->warn("largest histogram average bin contains only {} samples", largest_value);
+    }
+
+    double correction = 0.0;
+    if (largest_value > 0 and largest_index > 0 and largest_index < bins.size() - 1)
+    {
+        double lo_loss = (largest_value - bins[largest_index-1]) / ((double) largest_value);
+        double hi_loss = (largest_value - bins[largest_index+1]) / ((double) largest_value);
+        correction = (lo_loss - hi_loss) / 2.0;
+    }
+
+    int64_t average = lower + largest_index * bin_width_ns + bin_width_ns / 2 + correction * bin_width_ns;
+    int64_t lowerWindow = lowerWindow_ns;
+    int64_t upperWindow = upperWindow_ns;
+    if (context.m_window_ns)
+    {
+        // same skew as the default window
+        lowerWindow = context.m_window_ns * lowerWindow_ns / (lowerWindow_ns + upperWindow_ns);
+        upperWindow = context.m_window_ns - lowerWindow;
+    }
+    context.selectRange(average - lowerWindow, average + upperWindow);
+}
+
+
+void PooledLowestWindow::run(FilterContext& context)
+{
+    const SampleList64& time = *context.m_time;
+    int64_t midpoint = time.front() + (time.back() - time.front()) / 2;
+    SampleList64 pooled = context.m_diff;
+    size_t pooledBursts = 0;
+
+    if (context.m_pool)
+    {
+        for (const PooledBurst& burst : *context.m_pool)
+        {
+            int64_t projection = (midpoint - burst.m_midpoint_ns) * context.m_drift_ppm / 1000000.0;
+            for (int64_t sample : burst.m_diff)
+            {
+                pooled.push_back(sample + projection);
+            }
+        }
+        pooledBursts = context.m_pool->size();
+    }
+
+    size_t used = std::min(poolSamples, pooled.size());
+    std::nth_element(pooled.begin(), pooled.begin() + used - 1, pooled.end());
+    int64_t threshold = std::max(pooled[used - 1], MathFunc::min(context.m_diff));
+    context.m_location = std::accumulate(pooled.begin(), pooled.begin() + used, 0.0) / used;
+    context.m_usedSamples = used;
+
+    context.selectRange(MathFunc::min(context.m_diff), threshold);
+
+    trace->debug("{}pooled {} samples from {} previous bursts, {} of the {} used are from this burst",
+                 context.m_logName, pooled.size() - context.m_diff.size(), pooledBursts,
+                 context.m_filteredDiff.size(), used);
+}
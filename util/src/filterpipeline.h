@@ -0,0 +1,329 @@
+#pragma once
+
+#include "mathfunc.h"
+#include "offsetmeasurement.h"
+#include "log.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+
+/// The best samples from a previous burst, referred to the burst midpoint.
+///
+struct PooledBurst
+{
+    int64_t m_midpoint_ns;
+    SampleList64 m_diff;
+};
+
+
+/// Everything the stages of a filter pipeline read and write while processing a single burst.
+///
+struct FilterContext
+{
+    // input
+    std::string m_logName;
+    const SampleList64* m_time = nullptr;
+    SampleList64 m_diff;
+    int m_samples = 0;
+    double m_drift_ppm = 0.0;
+    const std::deque<PooledBurst>* m_pool = nullptr;
+    // window width from a probe of the channel, 0 for the window stage default
+    int64_t m_window_ns = 0;
+
+    // output
+    SampleList64 m_filteredTime;
+    SampleList64 m_filteredDiff;
+    int64_t m_offset_ns = 0;
+    size_t m_usedSamples = 0;
+    OffsetMeasurement::ResultCode m_resultCode = OffsetMeasurement::PASS;
+
+    // scratch for stages further down the pipeline
+    double m_location = 0.0;
+    int64_t m_confidenceLower = 0;
+    int64_t m_confidenceUpper = 0;
+
+    void selectRange(int64_t lower, int64_t upper);
+};
+
+
+/// A copy of the raw samples from a burst and the state needed to filter them, i.e. something
+/// that can be filtered on another thread.
+///
+struct FilterInput
+{
+    std::string m_logName;
+    SampleList64 m_time;
+    SampleList64 m_diff;
+    int m_samples = 0;
+    double m_drift_ppm = 0.0;
+    std::deque<PooledBurst> m_pool;
+    int64_t m_window_ns = 0;
+
+    FilterContext context() const;
+};
+
+
+/// A sample filter turns the time and offset samples from a burst into a single offset.
+///
+class SampleFilter
+{
+public:
+    virtual ~SampleFilter() {}
+
+    static SampleFilter* create(const std::string& name);
+    static std::vector<std::string> names();
+
+    virtual const std::string& name() const = 0;
+    virtual void apply(FilterContext& context) const = 0;
+};
+
+
+// -------------------------------------------
+// Detrend stages
+
+/// Removes the drift across the burst. With e.g. 10 ppm a 5 second burst would otherwise
+/// smear the distribution over 50 us. The stages below then finds the offset at the burst
+/// midpoint.
+///
+struct Detrend
+{
+    static void run(FilterContext& context)
+    {
+        if (context.m_drift_ppm != 0.0)
+        {
+            MathFunc::detrend(*context.m_time, context.m_diff, context.m_drift_ppm);
+        }
+    }
+};
+
+
+struct NoDetrend
+{
+    static void run(FilterContext&) {}
+};
+
+
+// -------------------------------------------
+// Window stages, selects the filtered samples
+
+/// Development only in order to keep all samples for analysis.
+///
+struct AllSamples
+{
+    static void run(FilterContext& context)
+    {
+        context.m_filteredTime = *context.m_time;
+        context.m_filteredDiff = context.m_diff;
+    }
+};
+
+
+/// Least sophisticated but hard to beat.
+///
+struct LowestWindow
+{
+    static const int64_t range = 600000;
+
+    static void run(FilterContext& context)
+    {
+        int64_t minimum = MathFunc::min(context.m_diff);
+        context.selectRange(minimum, minimum + (context.m_window_ns ? context.m_window_ns : range));
+    }
+};
+
+
+/// A window around the largest bin in a histogram of the samples.
+///
+struct LargestBinWindow
+{
+    static const size_t nofBins = 100;
+    static const int histogramRange_ns = 1000000;
+    static const int64_t lowerWindow_ns = 300000;
+    static const int64_t upperWindow_ns = 110000;
+
+    static void run(FilterContext& context);
+};
+
+
+/// The samples up to the upper bound of the bootstrapped confidence interval of a low percentile.
+///
+struct PercentileWindow
+{
+    static const int percentile = 10;
+    static const int bootstrapResamples = 100;
+
+    static void run(FilterContext& context)
+    {
+        MathFunc::bootstrapPercentile(context.m_diff, percentile, bootstrapResamples,
+                                      context.m_confidenceLower, context.m_confidenceUpper);
+        context.selectRange(MathFunc::min(context.m_diff), context.m_confidenceUpper);
+
+        trace->debug("{}{}th percentile confidence {} to {} ns",
+                     context.m_logName, percentile, context.m_confidenceLower, context.m_confidenceUpper);
+    }
+};
+
+
+/// The samples within 3 bandwidths of the mode of a kernel density estimate.
+///
+struct KernelDensityWindow
+{
+    static void run(FilterContext& context)
+    {
+        double bandwidth;
+        context.m_location = MathFunc::kernelDensityMode(context.m_diff, bandwidth);
+        int64_t window = 3.0 * bandwidth;
+        context.selectRange(context.m_location - window, context.m_location + window);
+
+        trace->debug("{}kernel density mode {:.0f} ns, bandwidth {:.0f} ns",
+                     context.m_logName, context.m_location, bandwidth);
+    }
+};
+
+
+/// The lowest samples pooled with the best samples from the previous bursts, projected to the
+/// midpoint of this burst using the drift estimate. The samples from this burst that made
+/// it into the pool are the filtered samples.
+///
+struct PooledLowestWindow
+{
+    static const size_t poolSamples = 20;
+
+    static void run(FilterContext& context);
+};
+
+
+// -------------------------------------------
+// Estimator stages, produces the offset
+
+struct Mean
+{
+    static void run(FilterContext& context)
+    {
+        context.m_offset_ns = MathFunc::average(context.m_filteredDiff);
+    }
+};
+
+
+/// The percentile of all samples, as an estimate of the propagation floor.
+///
+struct LowPercentile
+{
+    static void run(FilterContext& context)
+    {
+        context.m_offset_ns = MathFunc::percentile(context.m_diff, PercentileWindow::percentile);
+    }
+};
+
+
+/// The location found by the window stage, e.g. a density mode or a pooled average.
+///
+struct WindowLocation
+{
+    static void run(FilterContext& context)
+    {
+        context.m_offset_ns = context.m_location;
+    }
+};
+
+
+// -------------------------------------------
+// Acceptance stages
+
+struct AcceptAll
+{
+    static void run(FilterContext&) {}
+};
+
+
+/// Thresholds in percent for package loss and for samples removed by the window.
+///
+template<int LossFailed, int LossWarn, int FilteredFailed, int FilteredWarn>
+struct AcceptLoss
+{
+    static void run(FilterContext& context);
+};
+
+
+/// As AcceptLoss but also fails if the percentile confidence interval is too wide.
+///
+template<int LossFailed, int LossWarn, int MaxConfidence_ns>
+struct AcceptConfidence
+{
+    static void run(FilterContext& context);
+};
+
+
+// -------------------------------------------
+
+/// A filter put together from a detrend, window, estimator and acceptance stage. The stages are
+/// static policies so the whole chain gets inlined into apply().
+///
+template<typename DetrendStage, typename WindowStage, typename EstimatorStage, typename AcceptanceStage>
+class FilterPipeline : public SampleFilter
+{
+public:
+    FilterPipeline(const std::string& name)
+        : m_name(name)
+    {
+    }
+
+    const std::string& name() const override
+    {
+        return m_name;
+    }
+
+    void apply(FilterContext& context) const override
+    {
+        if (context.m_diff.empty())
+        {
+            trace->error("{}fatal error in filter '{}': no data recieved", context.m_logName, m_name);
+            context.m_resultCode = OffsetMeasurement::NO_DATA;
+            return;
+        }
+
+        DetrendStage::run(context);
+        WindowStage::run(context);
+        if (!context.m_usedSamples)
+        {
+            context.m_usedSamples = context.m_filteredTime.size();
+        }
+        EstimatorStage::run(context);
+        AcceptanceStage::run(context);
+    }
+
+private:
+    std::string m_name;
+};
+
+
+bool acceptLoss(FilterContext& context,
+                double lossFailed, double lossWarn,
+                double filteredFailed, double filteredWarn);
+
+
+template<int LossFailed, int LossWarn, int FilteredFailed, int FilteredWarn>
+void AcceptLoss<LossFailed, LossWarn, FilteredFailed, FilteredWarn>::run(FilterContext& context)
+{
+    acceptLoss(context, LossFailed, LossWarn, FilteredFailed, FilteredWarn);
+}
+
+
+template<int LossFailed, int LossWarn, int MaxConfidence_ns>
+void AcceptConfidence<LossFailed, LossWarn, MaxConfidence_ns>::run(FilterContext& context)
+{
+    if (!acceptLoss(context, LossFailed, LossWarn, 100.0, 100.0))
+    {
+        return;
+    }
+
+    int64_t confidence = context.m_confidenceUpper - context.m_confidenceLower;
+    if (confidence > MaxConfidence_ns)
+    {
+        trace->warn("{}percentile confidence interval is {:.1f} us, bailing out",
+                    context.m_logName, confidence / 1000.0);
+        context.m_resultCode = OffsetMeasurement::FILTER_ERROR;
+    }
+}
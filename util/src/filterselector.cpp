@@ -0,0 +1,231 @@
+#include "filterselector.h"
+#include "log.h"
+#include "spdlog/fmt/fmt.h"
+
+#include <cmath>
+
+
+DelayDistribution DelayDistribution::fromSamples(const SampleList64& samples)
+{
+    DelayDistribution distribution;
+    size_t n = samples.size();
+    if (n < 4)
+    {
+        return distribution;
+    }
+
+    double p25 = MathFunc::percentile(samples, 25.0);
+    double p50 = MathFunc::percentile(samples, 50.0);
+    double p75 = MathFunc::percentile(samples, 75.0);
+    double p95 = MathFunc::percentile(samples, 95.0);
+
+    distribution.m_median_ns = p50;
+    distribution.m_iqr_ns = p75 - p25;
+    distribution.m_tailWeight = distribution.m_iqr_ns > 0.0 ? (p95 - p50) / distribution.m_iqr_ns : 0.0;
+
+    double mean = MathFunc::average(samples);
+    double m2 = 0.0;
+    double m3 = 0.0;
+    double m4 = 0.0;
+    for (int64_t sample : samples)
+    {
+        double d = sample - mean;
+        double d2 = d * d;
+        m2 += d2;
+        m3 += d2 * d;
+        m4 += d2 * d2;
+    }
+    m2 /= n;
+    m3 /= n;
+    m4 /= n;
+
+    if (m2 > 0.0)
+    {
+        distribution.m_skewness = m3 / std::pow(m2, 1.5);
+        double excessKurtosis = m4 / (m2 * m2) - 3.0;
+        distribution.m_bimodality = (distribution.m_skewness * distribution.m_skewness + 1.0) /
+                                    (excessKurtosis + 3.0 * (n - 1) * (n - 1) / ((n - 2) * (n - 3)));
+    }
+    return distribution;
+}
+
+
+/// Running average where count is the number of distributions accumulated so far.
+///
+void DelayDistribution::accumulate(const DelayDistribution& other, int count)
+{
+    double weight = 1.0 / (count + 1);
+    m_median_ns += (other.m_median_ns - m_median_ns) * weight;
+    m_iqr_ns += (other.m_iqr_ns - m_iqr_ns) * weight;
+    m_skewness += (other.m_skewness - m_skewness) * weight;
+    m_tailWeight += (other.m_tailWeight - m_tailWeight) * weight;
+    m_bimodality += (other.m_bimodality - m_bimodality) * weight;
+}
+
+
+/// Only the shape is compared, the median will move with the clock offset.
+///
+bool DelayDistribution::changedFrom(const DelayDistribution& baseline) const
+{
+    if (baseline.m_iqr_ns <= 0.0 || baseline.m_tailWeight <= 0.0)
+    {
+        return false;
+    }
+
+    double iqrRatio = m_iqr_ns / baseline.m_iqr_ns;
+    double tailRatio = m_tailWeight / baseline.m_tailWeight;
+    bool wasMultimodal = baseline.m_bimodality > 0.555;
+
+    return iqrRatio < 0.5 || iqrRatio > 2.0 ||
+           tailRatio < 0.5 || tailRatio > 2.0 ||
+           std::fabs(m_skewness - baseline.m_skewness) > 1.0 ||
+           (wasMultimodal ? m_bimodality < 0.455 : m_bimodality > 0.655);
+}
+
+
+std::string DelayDistribution::toString() const
+{
+    return fmt::format("iqr.us={:.1f} skew={:.2f} tail={:.2f} bimodality={:.2f}",
+                       m_iqr_ns / 1000.0, m_skewness, m_tailWeight, m_bimodality);
+}
+
+// -------------------------------------------
+
+
+FilterSelector::FilterSelector(const std::string& logName, const std::string& currentFilter)
+    : m_logName(logName),
+      m_currentFilter(currentFilter),
+      m_shadowFilters(logName)
+{
+}
+
+
+/// Feed the raw burst and the production result. Returns the name of the filter to switch to,
+/// or an empty string if the current filter should be kept.
+///
+std::string FilterSelector::update(const FilterInput& input, const OffsetMeasurement& production)
+{
+    if (!m_enabled)
+    {
+        return "";
+    }
+
+    DelayDistribution distribution = DelayDistribution::fromSamples(input.m_diff);
+    m_bursts++;
+
+    if (m_state == EVALUATING)
+    {
+        m_baseline.accumulate(distribution, m_bursts - 1);
+        m_shadowFilters.evaluate(input, production);
+
+        if (m_bursts >= m_evaluationBursts)
+        {
+            return selectFilter();
+        }
+        return "";
+    }
+
+    m_changedBursts = distribution.changedFrom(m_baseline) ? m_changedBursts + 1 : 0;
+    if (m_changedBursts >= m_changedBurstsLimit)
+    {
+        trace->info("{}delay distribution changed to {}, reevaluating filters", m_logName, distribution.toString());
+        startEvaluation();
+    }
+    else if (m_bursts >= m_reevaluationBursts)
+    {
+        startEvaluation();
+    }
+    return "";
+}
+
+
+void FilterSelector::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    if (m_enabled)
+    {
+        startEvaluation();
+    }
+    else
+    {
+        m_shadowFilters.setFilters("off");
+    }
+}
+
+
+bool FilterSelector::enabled() const
+{
+    return m_enabled;
+}
+
+
+std::string FilterSelector::getReport() const
+{
+    if (!m_enabled)
+    {
+        return "filter selection off";
+    }
+    return fmt::format("filter '{}'{} {}", m_currentFilter, m_state == EVALUATING ? " (evaluating)" : "",
+                       m_baseline.toString());
+}
+
+
+void FilterSelector::startEvaluation()
+{
+    m_state = EVALUATING;
+    m_bursts = 0;
+    m_changedBursts = 0;
+    m_baseline = DelayDistribution();
+    m_shadowFilters.setFilters("all");
+}
+
+
+/// The candidate with the lowest jitter wins unless the current filter is close enough.
+/// The jobs for the very last burst might still be running which doesn't matter.
+///
+std::string FilterSelector::selectFilter()
+{
+    std::vector<ShadowFilterStats> stats = m_shadowFilters.getStats();
+    m_shadowFilters.setFilters("off");
+    m_state = SELECTED;
+    m_bursts = 0;
+
+    const ShadowFilterStats* best = nullptr;
+    const ShadowFilterStats* current = nullptr;
+
+    // the first entry is production itself
+    for (size_t i = 1; i < stats.size(); i++)
+    {
+        const ShadowFilterStats& candidate = stats[i];
+        if (candidate.m_jitterCount < 2 || candidate.passedPct() < m_minimumPassedPct)
+        {
+            continue;
+        }
+        if (candidate.m_name == m_currentFilter)
+        {
+            current = &candidate;
+        }
+        if (!best || candidate.jitter_us() < best->jitter_us())
+        {
+            best = &candidate;
+        }
+    }
+
+    trace->info("{}delay distribution {}", m_logName, m_baseline.toString());
+
+    if (!best || best == current)
+    {
+        return "";
+    }
+    if (current && best->jitter_us() > current->jitter_us() * m_hysteresis)
+    {
+        return "";
+    }
+
+    trace->info("{}selecting filter '{}' with jitter {:.1f} us (was '{}' with {:.1f} us)",
+                m_logName, best->m_name, best->jitter_us(), m_currentFilter,
+                current ? current->jitter_us() : 0.0);
+
+    m_currentFilter = best->m_name;
+    return m_currentFilter;
+}
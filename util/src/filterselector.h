@@ -0,0 +1,71 @@
+#pragma once
+
+#include "shadowfilters.h"
+
+#include <string>
+
+
+/// Shape of the delay distribution in a burst.
+///
+struct DelayDistribution
+{
+    double m_median_ns = 0.0;
+    double m_iqr_ns = 0.0;
+    double m_skewness = 0.0;
+    // (p95 - p50) / (p75 - p25), about 1.2 for a gaussian and 2.1 for an exponential
+    double m_tailWeight = 0.0;
+    // bimodality coefficient, above 0.555 hints at a multimodal distribution
+    double m_bimodality = 0.0;
+
+    static DelayDistribution fromSamples(const SampleList64& samples);
+    void accumulate(const DelayDistribution& other, int count);
+    bool changedFrom(const DelayDistribution& baseline) const;
+    std::string toString() const;
+};
+
+
+/// Selects the filter for a single client from how the filters actually perform on the link.
+/// During an evaluation all candidate filters run in shadow mode and the filter with the
+/// lowest burst to burst jitter (i.e. residual variance) wins. A new evaluation is started
+/// periodically and when the shape of the delay distribution changes.
+///
+/// Off by default, enabled with 'control --filter auto'. The jitter is that of the server's
+/// one way estimate and drift and servo steps add to it, so the selection is a hint rather
+/// than a measurement of the offset error.
+///
+class FilterSelector
+{
+public:
+    FilterSelector(const std::string& logName, const std::string& currentFilter);
+
+    std::string update(const FilterInput& input, const OffsetMeasurement& production);
+    void setEnabled(bool enabled);
+    bool enabled() const;
+    std::string getReport() const;
+
+private:
+    void startEvaluation();
+    std::string selectFilter();
+
+    enum State
+    {
+        EVALUATING,
+        SELECTED
+    };
+
+    std::string m_logName;
+    std::string m_currentFilter;
+    ShadowFilters m_shadowFilters;
+    bool m_enabled = false;
+    State m_state = EVALUATING;
+    int m_bursts = 0;
+    int m_changedBursts = 0;
+    DelayDistribution m_baseline;
+
+    const int m_evaluationBursts = 20;
+    const int m_reevaluationBursts = 500;
+    const int m_changedBurstsLimit = 3;
+    const double m_minimumPassedPct = 90.0;
+    // a candidate has to be this much better than the current filter in order to replace it
+    const double m_hysteresis = 0.9;
+};
@@ -2,8 +2,11 @@
 #include "log.h"
 
 #include <QtGlobal>
+#include <algorithm>
+#include <cmath>
 #include <iterator>
 #include <numeric>
+#include <random>
 
 
 bool MathFunc::linearRegression(const SampleList64 &_x, const SampleList64 &_y, double &slope, double &constant)
@@ -36,6 +39,99 @@ bool MathFunc::linearRegression(const SampleList64 &_x, const SampleList64 &_y,
 }
 
 
+/// As linearRegression but with a weight for each sample. The constant is relative to
+/// the first sample.
+///
+bool MathFunc::weightedLinearRegression(const SampleList64 &_x, const SampleList64 &_y, const std::vector<double> &weights,
+                                        double &slope, double &constant)
+{
+    size_t n = _x.size();
+    double sumWeights = 0.0;
+    double avgX = 0.0;
+    double avgY = 0.0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        sumWeights += weights[i];
+        avgX += weights[i] * (_x[i] - _x.front());
+        avgY += weights[i] * (_y[i] - _y.front());
+    }
+    if (sumWeights <= 0.0)
+    {
+        return linearRegression(_x, _y, slope, constant);
+    }
+    avgX /= sumWeights;
+    avgY /= sumWeights;
+
+    double numerator = 0.0;
+    double denominator = 0.0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        double dx = (_x[i] - _x.front()) - avgX;
+        double dy = (_y[i] - _y.front()) - avgY;
+        numerator += weights[i] * dx * dy;
+        denominator += weights[i] * dx * dx;
+    }
+    slope = numerator / denominator;
+    constant = avgY - slope * avgX;
+
+    return true;
+}
+
+
+/// Theil-Sen slope, i.e. the median of the slopes between all sample pairs. Each pair
+/// slope is weighted with the product of the two sample weights. O(n^2) which is fine
+/// for the ~100 measurements in a history.
+///
+double MathFunc::theilSen(const SampleList64 &_x, const SampleList64 &_y, const std::vector<double> &weights)
+{
+    std::vector<std::pair<double, double>> slopes;
+    size_t n = _x.size();
+    slopes.reserve(n * (n - 1) / 2);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t j = i + 1; j < n; ++j)
+        {
+            if (_x[j] != _x[i])
+            {
+                double slope = double(_y[j] - _y[i]) / double(_x[j] - _x[i]);
+                slopes.push_back({slope, weights[i] * weights[j]});
+            }
+        }
+    }
+    return weightedMedian(slopes);
+}
+
+
+double MathFunc::weightedMedian(std::vector<std::pair<double, double>> valueWeights)
+{
+    if (valueWeights.empty())
+    {
+        return 0.0;
+    }
+    std::sort(valueWeights.begin(), valueWeights.end());
+
+    double total = 0.0;
+    for (const auto& valueWeight : valueWeights)
+    {
+        total += valueWeight.second;
+    }
+
+    double accumulated = 0.0;
+    for (const auto& valueWeight : valueWeights)
+    {
+        accumulated += valueWeight.second;
+        if (accumulated >= total / 2.0)
+        {
+            return valueWeight.first;
+        }
+    }
+    return valueWeights.back().first;
+}
+
+
 /// Uses zero mean so this is also/actually root mean square as well
 ///
 double MathFunc::standardDeviation(const SampleList64 &samples)
@@ -86,6 +182,146 @@ int64_t MathFunc::min(const SampleList64& samples)
 }
 
 
+/// Returns the sample at the given percentile (0-100) using nth_element, i.e. in linear time.
+/// The samples are taken by value since nth_element reorders them.
+///
+int64_t MathFunc::percentile(SampleList64 samples, double pct)
+{
+    size_t index = (samples.size() - 1) * qBound(0.0, pct, 100.0) / 100.0;
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+
+int64_t MathFunc::median(const SampleList64 &samples)
+{
+    return percentile(samples, 50.0);
+}
+
+
+int64_t MathFunc::medianAbsoluteDeviation(const SampleList64 &samples, int64_t median)
+{
+    SampleList64 deviations;
+    deviations.reserve(samples.size());
+    for (int64_t sample : samples)
+    {
+        deviations.push_back(std::abs(sample - median));
+    }
+    return percentile(deviations, 50.0);
+}
+
+
+/// Returns the mode of a gaussian kernel density estimate of the samples. The bandwidth is
+/// Silverman's rule of thumb on the smaller of the standard deviation and the interquartile
+/// range, so a long tail doesn't widen it. The samples are linear binned on a grid of a quarter
+/// bandwidth before the kernel is applied which keeps it O(n), and the peak is refined
+/// with a parabola through the largest bin and its neighbours.
+///
+double MathFunc::kernelDensityMode(const SampleList64 &samples, double &bandwidth)
+{
+    const int kernelHalfwidth = 12; // 3 bandwidths in quarter bandwidth bins
+    const size_t maxBins = 4096;
+
+    size_t n = samples.size();
+    double iqr = percentile(samples, 75.0) - percentile(samples, 25.0);
+    double spread = std::min(standardDeviation(samples), iqr / 1.34);
+    if (spread <= 0.0)
+    {
+        spread = standardDeviation(samples);
+    }
+    if (spread <= 0.0)
+    {
+        bandwidth = 0.0;
+        return samples.front();
+    }
+    bandwidth = 0.9 * spread * std::pow(n, -0.2);
+
+    // the grid ends at the 99th percentile, the remaining far out stragglers are ignored
+    double lower = min(samples);
+    double upper = percentile(samples, 99.0);
+    double binWidth = std::max(bandwidth / 4.0, (upper - lower) / (maxBins - 2 * kernelHalfwidth - 1));
+    size_t nofBins = (upper - lower) / binWidth + 2 * kernelHalfwidth + 2;
+    double origin = lower - kernelHalfwidth * binWidth;
+
+    std::vector<double> bins(nofBins, 0.0);
+    for (int64_t sample : samples)
+    {
+        double position = (sample - origin) / binWidth;
+        size_t index = position;
+        if (index + 1 >= nofBins)
+        {
+            continue;
+        }
+        double fraction = position - index;
+        bins[index] += 1.0 - fraction;
+        bins[index + 1] += fraction;
+    }
+
+    std::vector<double> kernel(2 * kernelHalfwidth + 1);
+    for (int k = -kernelHalfwidth; k <= kernelHalfwidth; k++)
+    {
+        double u = k * binWidth / bandwidth;
+        kernel[k + kernelHalfwidth] = std::exp(-0.5 * u * u);
+    }
+
+    std::vector<double> density(nofBins, 0.0);
+    size_t largest = kernelHalfwidth;
+    for (size_t i = kernelHalfwidth; i < nofBins - kernelHalfwidth; i++)
+    {
+        for (int k = -kernelHalfwidth; k <= kernelHalfwidth; k++)
+        {
+            density[i] += bins[i + k] * kernel[k + kernelHalfwidth];
+        }
+        if (density[i] > density[largest])
+        {
+            largest = i;
+        }
+    }
+
+    double delta = 0.0;
+    if (largest > 0 and largest < nofBins - 1)
+    {
+        double y0 = density[largest - 1];
+        double y1 = density[largest];
+        double y2 = density[largest + 1];
+        double denominator = y0 - 2.0 * y1 + y2;
+        if (denominator < 0.0)
+        {
+            delta = qBound(-0.5, 0.5 * (y0 - y2) / denominator, 0.5);
+        }
+    }
+
+    return origin + (largest + delta) * binWidth;
+}
+
+
+/// Bootstrap a 90% confidence interval for the given percentile. The random generator has a
+/// fixed seed so that the same data always gives the same bounds.
+///
+void MathFunc::bootstrapPercentile(const SampleList64 &samples, double pct, int resamples,
+                                   int64_t &lower, int64_t &upper)
+{
+    std::minstd_rand generator(samples.size());
+    std::uniform_int_distribution<size_t> pick(0, samples.size() - 1);
+
+    SampleList64 resampled(samples.size());
+    SampleList64 estimates;
+    estimates.reserve(resamples);
+
+    for (int i = 0; i < resamples; i++)
+    {
+        for (auto& sample : resampled)
+        {
+            sample = samples[pick(generator)];
+        }
+        estimates.push_back(percentile(resampled, pct));
+    }
+
+    lower = percentile(estimates, 5.0);
+    upper = percentile(estimates, 95.0);
+}
+
+
 SampleList64 MathFunc::sort(const SampleList64 &samples)
 {
     SampleList64 sorted = samples;
@@ -103,3 +339,20 @@ SampleList64 MathFunc::diff(const SampleList64 &sampleList1, const SampleList64
                    std::minus<int64_t>());
     return diff;
 }
+
+
+/// Remove a linear drift given in ppm from the samples, pivoting around the middle
+/// of the time span so the sample values becomes those at the midpoint.
+///
+void MathFunc::detrend(const SampleList64 &time, SampleList64 &samples, double ppm)
+{
+    if (time.empty())
+    {
+        return;
+    }
+    int64_t midpoint = time.front() + (time.back() - time.front()) / 2;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        samples[i] -= (time[i] - midpoint) * ppm / 1000000.0;
+    }
+}
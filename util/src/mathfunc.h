@@ -13,6 +13,13 @@ class MathFunc
 public:
     static bool linearRegression(const SampleList64 &_x, const SampleList64 &_y, double &slope, double &constant);
 
+    static bool weightedLinearRegression(const SampleList64 &_x, const SampleList64 &_y, const std::vector<double> &weights,
+                                         double &slope, double &constant);
+
+    static double theilSen(const SampleList64 &_x, const SampleList64 &_y, const std::vector<double> &weights);
+
+    static double weightedMedian(std::vector<std::pair<double, double>> valueWeights);
+
     static double standardDeviation(const SampleList64 &samples);
 
     static double standardDeviation(const SampleList64 &_x, const SampleList64 &_y, double slope);
@@ -21,7 +28,20 @@ public:
 
     static int64_t min(const SampleList64 &samples);
 
+    static int64_t percentile(SampleList64 samples, double pct);
+
+    static int64_t median(const SampleList64 &samples);
+
+    static int64_t medianAbsoluteDeviation(const SampleList64 &samples, int64_t median);
+
+    static double kernelDensityMode(const SampleList64 &samples, double &bandwidth);
+
+    static void bootstrapPercentile(const SampleList64 &samples, double pct, int resamples,
+                                    int64_t &lower, int64_t &upper);
+
     static SampleList64 sort(const SampleList64 &samples);
 
     static SampleList64 diff(const SampleList64 &sampleList1, const SampleList64 &sampleList2);
+
+    static void detrend(const SampleList64 &time, SampleList64 &samples, double ppm);
 };
@@ -2,6 +2,7 @@
 
 #include "offsetmeasurement.h"
 #include "globals.h"
+#include "filterpipeline.h"
 #include <vector>
 
 
@@ -14,11 +15,15 @@ public:
         DEFAULT,
         EVERYTHING,    // development only in order to keep all samples for analysis
         LOWEST_VALUES, // least sophisticated but hard to beat.
-        LARGEST_BIN_WINDOW  // default for VCTCXO, not tested in software mode
+        LARGEST_BIN_WINDOW, // default for VCTCXO, not tested in software mode
+        LOW_PERCENTILE,     // a low percentile of the delays as an estimate of the propagation floor
+        KERNEL_DENSITY_MODE,// mode of a kernel density estimate with a bandwidth adapted to the data
+        POOLED_LOWEST       // lowest values pooled with the best samples from the previous bursts
     };
 
     const std::vector<std::string> FilterAsString = {
-        "default", "everything", "lowest values", "largest bin window"};
+        "default", "everything", "lowest values", "largest bin window", "low percentile", "kernel density mode",
+        "pooled lowest"};
 
 
     virtual ~MeasurementSeriesBase() {}
@@ -31,6 +36,24 @@ public:
 
     virtual void setFiltering(FilterType filterType) = 0;
 
+    virtual bool setFiltering(const std::string& filterName) = 0;
+
+    virtual std::string getFilterName() const = 0;
+
+    virtual void setDriftEstimate(double ppm) = 0;
+
+    virtual void setWindow_ns(int64_t window_ns) = 0;
+
+    virtual void clearPool() = 0;
+
+    virtual void ppmAdjusted(double ppm, int64_t at_ns) = 0;
+
+    virtual FilterInput getFilterInput() const = 0;
+
+    virtual const SampleList64& getRemoteTime() const = 0;
+
+    virtual const SampleList64& getLocalTime() const = 0;
+
     virtual void saveRawMeasurements(std::string filename, int serial) const = 0;
 
     virtual void saveFilteredMeasurements(std::string filename, int serial) const = 0;
@@ -49,9 +49,14 @@ public:
     int64_t m_offset_ns;
     int64_t m_clientOffset_ns = 0;
     ResultCode m_resultCode = ResultCode::PASS;
+    // standard deviation of the used samples
+    int64_t m_spread_ns = 0;
 
     // does not really belong here but the current client ppm needed a home
     // for analysis table dumps
     double m_ppm = 0.0;
 
+    // rejected by the hampel screen in OffsetMeasurementHistory
+    bool m_outlier = false;
+
 };
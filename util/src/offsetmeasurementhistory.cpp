@@ -6,6 +6,16 @@
 #include <numeric>
 #include <cmath>
 
+const size_t HAMPEL_WINDOW = 9;
+const size_t HAMPEL_MIN_WINDOW = 5;
+const int HAMPEL_MAX_CONSECUTIVE = 3;
+const double HAMPEL_SIGMAS = 3.0;
+const double HAMPEL_FLOOR_NS = 5000.0;
+
+const std::vector<std::string> OffsetMeasurementHistory::DriftEstimatorAsString = {
+    "ls", "wls", "theilsen"};
+
+
 OffsetMeasurementHistory::OffsetMeasurementHistory(double minSeconds, int minMeasurements)
     : m_minSeconds(minSeconds),
       m_minMeasurements(minMeasurements)
@@ -19,12 +29,56 @@ void OffsetMeasurementHistory::setFlags(DevelopmentMask develMask)
 }
 
 
+bool OffsetMeasurementHistory::fromString(const std::string& name, DriftEstimator& driftEstimator)
+{
+    for (size_t i = 0; i < DriftEstimatorAsString.size(); i++)
+    {
+        if (DriftEstimatorAsString[i] == name)
+        {
+            driftEstimator = static_cast<DriftEstimator>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/// The estimator for the ppm regression over the history, see the control option --driftestimator.
+///
+void OffsetMeasurementHistory::setDriftEstimator(DriftEstimator driftEstimator)
+{
+    if (driftEstimator != m_driftEstimator)
+    {
+        trace->info("drift estimator is '{}'", DriftEstimatorAsString[driftEstimator]);
+    }
+    m_driftEstimator = driftEstimator;
+}
+
+
+/// A burst is weighted as the inverse variance of its mean, i.e. used samples over
+/// the squared spread. The spread is floored at 1 us so a single lucky burst doesn't
+/// take over completely.
+///
+static double burstWeight(const OffsetMeasurement& measurement)
+{
+    double used = std::max<size_t>(measurement.m_usedSamples, 1);
+    double spread_us = std::max(measurement.m_spread_ns / 1000.0, 1.0);
+    return used / (spread_us * spread_us);
+}
+
+
 int OffsetMeasurementHistory::getCounter() const
 {
     return m_loop;
 }
 
 
+int OffsetMeasurementHistory::getOutliers() const
+{
+    return m_outliers;
+}
+
+
 void OffsetMeasurementHistory::reset()
 {
     m_offsetMeasurements.clear();
@@ -32,11 +86,35 @@ void OffsetMeasurementHistory::reset()
     m_loop = 0;
     m_slope = 0.0;
     m_averageSlope = 0.0;
+    m_screenWindow.clear();
+    m_consecutiveOutliers = 0;
+}
+
+
+/// Start from a known drift after a restart, see DriftState. The drift is used until there
+/// are measurements enough for a regression and the averages are settled after one more.
+///
+void OffsetMeasurementHistory::seed(double ppm)
+{
+    m_slope = ppm / 1000000.0;
+    m_averageSlope = m_slope;
+    m_movingAverageSlope.assign(1, m_slope);
+    m_initialize = 1;
 }
 
 
-void OffsetMeasurementHistory::add(OffsetMeasurement sum)
+/// Returns false if the measurement was rejected as an outlier, in which case
+/// it is not used for the ppm regression.
+///
+bool OffsetMeasurementHistory::add(OffsetMeasurement sum)
 {
+    if (isOutlier(sum))
+    {
+        m_outliers++;
+        trace->warn("offset {:.1f} us rejected as outlier ({} so far)", sum.m_offset_ns / 1000.0, m_outliers);
+        return false;
+    }
+
     m_loop++;
     m_offsetMeasurements.push_back(sum);
     if (m_develMask & DevelopmentMask::AnalysisAppendToSummary)
@@ -51,6 +129,40 @@ void OffsetMeasurementHistory::add(OffsetMeasurement sum)
     }
 
     update();
+    return true;
+}
+
+
+/// Hampel screen of the new offset against the median and median absolute deviation of the
+/// most recent offsets, with the current slope taken out so a drifting client isn't flagged.
+/// A run of outliers is taken as a genuine change and lets the next one through.
+///
+bool OffsetMeasurementHistory::isOutlier(const OffsetMeasurement& sum)
+{
+    bool outlier = false;
+
+    if (m_screenWindow.size() >= HAMPEL_MIN_WINDOW && m_consecutiveOutliers < HAMPEL_MAX_CONSECUTIVE)
+    {
+        SampleList64 residuals;
+        for (const auto& entry : m_screenWindow)
+        {
+            residuals.push_back(entry.second - m_slope * (entry.first - sum.m_endtime_ns));
+        }
+        int64_t median = MathFunc::median(residuals);
+        double mad = MathFunc::medianAbsoluteDeviation(residuals, median);
+        double limit = std::max(HAMPEL_SIGMAS * 1.4826 * mad, HAMPEL_FLOOR_NS);
+        outlier = std::fabs(sum.m_offset_ns - median) > limit;
+    }
+
+    m_consecutiveOutliers = outlier ? m_consecutiveOutliers + 1 : 0;
+
+    m_screenWindow.push_back({sum.m_endtime_ns, sum.m_offset_ns});
+    if (m_screenWindow.size() > HAMPEL_WINDOW)
+    {
+        m_screenWindow.pop_front();
+    }
+
+    return outlier;
 }
 
 
@@ -58,6 +170,7 @@ void OffsetMeasurementHistory::update()
 {
     SampleList64 m_time;
     SampleList64 m_offset;
+    std::vector<double> weights;
 
     m_totalMeasurements = 0;
 
@@ -65,6 +178,7 @@ void OffsetMeasurementHistory::update()
     {
         m_time.push_back(summary.m_endtime_ns);
         m_offset.push_back(summary.m_offset_ns);
+        weights.push_back(burstWeight(summary));
         m_totalMeasurements += summary.m_collectedSamples;
     }
 
@@ -76,7 +190,18 @@ void OffsetMeasurementHistory::update()
     }
 
     double constant;
-    MathFunc::linearRegression(m_time, m_offset, m_slope, constant);
+    switch (m_driftEstimator)
+    {
+    case LEAST_SQUARES:
+        MathFunc::linearRegression(m_time, m_offset, m_slope, constant);
+        break;
+    case WEIGHTED_LEAST_SQUARES:
+        MathFunc::weightedLinearRegression(m_time, m_offset, weights, m_slope, constant);
+        break;
+    case THEIL_SEN:
+        m_slope = MathFunc::theilSen(m_time, m_offset, weights);
+        break;
+    }
 
     OffsetMeasurement& last_measurement = m_offsetMeasurements.back();
 
@@ -3,18 +3,33 @@
 #include "basicoffsetmeasurement.h"
 
 #include <deque>
+#include <string>
+#include <vector>
 
 using OffsetMeasurementVector = std::vector<OffsetMeasurement>;
 
 class OffsetMeasurementHistory
 {
 public:
+    enum DriftEstimator
+    {
+        LEAST_SQUARES,
+        WEIGHTED_LEAST_SQUARES, // default, bursts weighted by used samples and spread
+        THEIL_SEN               // weighted median of pairwise slopes, robust against outliers
+    };
+
+    static const std::vector<std::string> DriftEstimatorAsString;
+
     OffsetMeasurementHistory(double maxSeconds = 3600.0, int maxMeasurements = 100);
 
-    void add(OffsetMeasurement sum);
+    static bool fromString(const std::string& name, DriftEstimator& driftEstimator);
+
+    bool add(OffsetMeasurement sum);
 
     void reset();
+    void seed(double ppm);
     void setFlags(DevelopmentMask develMask);
+    void setDriftEstimator(DriftEstimator driftEstimator);
 
     double getPPM() const;
     double getMovingAveragePPM() const;
@@ -25,10 +40,12 @@ public:
     std::string clientToString(uint16_t dac) const;
     OffsetMeasurementVector getMeasurementsSummary() const;
     int getCounter() const;
+    int getOutliers() const;
     size_t size() const;
 
 private:
     void update();
+    bool isOutlier(const OffsetMeasurement& sum);
     double getTimeSpan_sec() const;
 
 private:
@@ -39,6 +56,7 @@ private:
     double m_minSeconds;
     int m_minMeasurements;
     DevelopmentMask m_develMask = DevelopmentMask::None;
+    DriftEstimator m_driftEstimator = WEIGHTED_LEAST_SQUARES;
     double m_slope = 0.0;
     double m_sd_ns = -1.0;
     int m_loop = 0;
@@ -49,5 +67,10 @@ private:
     int m_initialize = NOF_INITIAL_PPM_MEASUREMENTS + 1;
     int m_totalMeasurements = 0;
 
+    // hampel screen, the time and offset of the most recent measurements including outliers
+    std::deque<std::pair<int64_t, int64_t>> m_screenWindow;
+    int m_consecutiveOutliers = 0;
+    int m_outliers = 0;
+
     friend class DataAnalyse;
 };
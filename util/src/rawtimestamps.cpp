@@ -0,0 +1,92 @@
+#include "rawtimestamps.h"
+
+#include <QByteArray>
+
+#include <algorithm>
+
+
+static void putVarint(QByteArray& data, int64_t value)
+{
+    uint64_t zigzag = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    while (zigzag >= 0x80)
+    {
+        data.append((char) ((zigzag & 0x7f) | 0x80));
+        zigzag >>= 7;
+    }
+    data.append((char) zigzag);
+}
+
+
+static bool getVarint(const QByteArray& data, int& index, int64_t& value)
+{
+    uint64_t zigzag = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (index >= data.size())
+        {
+            return false;
+        }
+        uint8_t byte = (uint8_t) data.at(index++);
+        zigzag |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+QString RawTimestamps::encode(const SampleList64& remoteTime, const SampleList64& localTime)
+{
+    size_t samples = std::min(remoteTime.size(), localTime.size());
+
+    QByteArray data;
+    putVarint(data, samples);
+
+    int64_t previousRemote = 0;
+    int64_t previousDelay = 0;
+    for (size_t i = 0; i < samples; i++)
+    {
+        int64_t delay = localTime[i] - remoteTime[i];
+        putVarint(data, remoteTime[i] - previousRemote);
+        putVarint(data, delay - previousDelay);
+        previousRemote = remoteTime[i];
+        previousDelay = delay;
+    }
+    return QString(data.toBase64());
+}
+
+
+bool RawTimestamps::decode(const QString& encoded, SampleList64& remoteTime, SampleList64& localTime)
+{
+    QByteArray data = QByteArray::fromBase64(encoded.toLatin1());
+    remoteTime.clear();
+    localTime.clear();
+
+    int index = 0;
+    int64_t samples;
+    if (!getVarint(data, index, samples) || samples < 0 || samples > data.size())
+    {
+        return false;
+    }
+
+    int64_t remote = 0;
+    int64_t delay = 0;
+    for (int64_t i = 0; i < samples; i++)
+    {
+        int64_t deltaRemote, deltaDelay;
+        if (!getVarint(data, index, deltaRemote) || !getVarint(data, index, deltaDelay))
+        {
+            remoteTime.clear();
+            localTime.clear();
+            return false;
+        }
+        remote += deltaRemote;
+        delay += deltaDelay;
+        remoteTime.push_back(remote);
+        localTime.push_back(remote + delay);
+    }
+    return true;
+}
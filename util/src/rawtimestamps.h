@@ -0,0 +1,18 @@
+#pragma once
+
+#include "mathfunc.h"
+
+#include <QString>
+
+
+/// Compact text encoding of the raw remote and local timestamps from a burst, small enough to
+/// fit a tcp message. The first sample is sent as is and the rest as differences from the
+/// previous sample, i.e. the time between samples and the change in delay. All values are
+/// zigzag varints and the result is base64 encoded.
+///
+class RawTimestamps
+{
+public:
+    static QString encode(const SampleList64& remoteTime, const SampleList64& localTime);
+    static bool decode(const QString& encoded, SampleList64& remoteTime, SampleList64& localTime);
+};
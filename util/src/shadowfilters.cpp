@@ -0,0 +1,274 @@
+#include "shadowfilters.h"
+#include "log.h"
+#include "spdlog/fmt/fmt.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+
+void ShadowFilterStats::add(int serial, bool passed, int64_t offset_ns, size_t usedSamples, int64_t spread_ns,
+                            int64_t production_ns)
+{
+    m_bursts++;
+    if (!passed)
+    {
+        return;
+    }
+    m_passed++;
+
+    double diff = offset_ns - production_ns;
+    m_sumDiff_ns += diff;
+    m_sumSquaredDiff_ns += diff * diff;
+    m_sumUsedSamples += usedSamples;
+    m_sumSpread_ns += spread_ns;
+
+    // jobs for consecutive bursts can finish out of order, only count the jitter for bursts
+    // arriving in order.
+    if (serial > m_lastSerial)
+    {
+        if (m_lastSerial >= 0 && serial == m_lastSerial + 1)
+        {
+            double jitter = offset_ns - m_lastOffset_ns;
+            m_sumSquaredJitter_ns += jitter * jitter;
+            m_jitterCount++;
+        }
+        m_lastSerial = serial;
+        m_lastOffset_ns = offset_ns;
+        m_lastUsedSamples = usedSamples;
+        m_lastSpread_ns = spread_ns;
+    }
+}
+
+
+double ShadowFilterStats::meanDiff_us() const
+{
+    return m_passed ? m_sumDiff_ns / m_passed / 1000.0 : 0.0;
+}
+
+
+double ShadowFilterStats::rmsDiff_us() const
+{
+    return m_passed ? std::sqrt(m_sumSquaredDiff_ns / m_passed) / 1000.0 : 0.0;
+}
+
+
+double ShadowFilterStats::jitter_us() const
+{
+    return m_jitterCount ? std::sqrt(m_sumSquaredJitter_ns / m_jitterCount) / 1000.0 : 0.0;
+}
+
+
+double ShadowFilterStats::usedSamples() const
+{
+    return m_passed ? m_sumUsedSamples / m_passed : 0.0;
+}
+
+
+double ShadowFilterStats::spread_us() const
+{
+    return m_passed ? m_sumSpread_ns / m_passed / 1000.0 : 0.0;
+}
+
+
+double ShadowFilterStats::passedPct() const
+{
+    return m_bursts ? 100.0 * m_passed / m_bursts : 0.0;
+}
+
+// -------------------------------------------
+
+
+/// Runs a single filter on a single burst in the thread pool.
+///
+class ShadowFilters::Job : public QRunnable
+{
+public:
+    Job(std::shared_ptr<const SampleFilter> filter,
+        std::shared_ptr<const FilterInput> input,
+        std::shared_ptr<Shared> shared,
+        int serial,
+        int64_t production_ns)
+        : m_filter(filter),
+          m_input(input),
+          m_shared(shared),
+          m_serial(serial),
+          m_production_ns(production_ns)
+    {
+    }
+
+    void run() override
+    {
+        FilterContext context = m_input->context();
+        m_filter->apply(context);
+
+        bool passed = context.m_resultCode == OffsetMeasurement::PASS;
+        int64_t spread_ns = 0;
+        if (!context.m_filteredDiff.empty())
+        {
+            spread_ns = MathFunc::standardDeviation(context.m_filteredDiff);
+        }
+
+        QMutexLocker locker(&m_shared->m_mutex);
+        for (ShadowFilterStats& stats : m_shared->m_stats)
+        {
+            if (stats.m_name == m_filter->name())
+            {
+                stats.add(m_serial, passed, context.m_offset_ns, context.m_usedSamples, spread_ns, m_production_ns);
+                break;
+            }
+        }
+    }
+
+private:
+    std::shared_ptr<const SampleFilter> m_filter;
+    std::shared_ptr<const FilterInput> m_input;
+    std::shared_ptr<Shared> m_shared;
+    int m_serial;
+    int64_t m_production_ns;
+};
+
+// -------------------------------------------
+
+
+ShadowFilters::ShadowFilters(const std::string& logName)
+    : m_logName(logName),
+      m_shared(std::make_shared<Shared>())
+{
+    reset();
+}
+
+
+ShadowFilters::~ShadowFilters()
+{
+    m_threadPool.waitForDone();
+}
+
+
+/// Configure the shadow filters from a comma separated list of filter names, 'all' for
+/// all filters except 'everything' or 'off' to disable shadow mode.
+///
+bool ShadowFilters::setFilters(const std::string& filterList)
+{
+    std::vector<std::string> names;
+
+    if (filterList == "all")
+    {
+        for (const std::string& name : SampleFilter::names())
+        {
+            if (name != "everything")
+            {
+                names.push_back(name);
+            }
+        }
+    }
+    else if (filterList != "off" && !filterList.empty())
+    {
+        std::istringstream stream(filterList);
+        std::string name;
+        while (std::getline(stream, name, ','))
+        {
+            names.push_back(name);
+        }
+    }
+
+    std::vector<std::shared_ptr<const SampleFilter>> filters;
+    for (const std::string& name : names)
+    {
+        SampleFilter* filter = SampleFilter::create(name);
+        if (!filter)
+        {
+            trace->error("{}unknown shadow filter '{}'", m_logName, name);
+            return false;
+        }
+        filters.emplace_back(filter);
+    }
+
+    m_threadPool.waitForDone();
+    m_filters = filters;
+    reset();
+
+    trace->info("{}shadow filters '{}'", m_logName, filterList);
+    return true;
+}
+
+
+bool ShadowFilters::enabled() const
+{
+    return !m_filters.empty();
+}
+
+
+/// Hand a copy of the burst to the thread pool, one job per filter. The production result
+/// is recorded right away as the reference.
+///
+void ShadowFilters::evaluate(const FilterInput& input, const OffsetMeasurement& production)
+{
+    if (m_filters.empty())
+    {
+        return;
+    }
+
+    int serial = m_serial++;
+    {
+        QMutexLocker locker(&m_shared->m_mutex);
+        m_shared->m_stats.front().add(serial,
+                                      production.m_resultCode == OffsetMeasurement::PASS,
+                                      production.m_offset_ns,
+                                      production.m_usedSamples,
+                                      production.m_spread_ns,
+                                      production.m_offset_ns);
+    }
+
+    auto shadowInput = std::make_shared<FilterInput>(input);
+    shadowInput->m_logName = m_logName + "shadow ";
+
+    for (const auto& filter : m_filters)
+    {
+        m_threadPool.start(new Job(filter, shadowInput, m_shared, serial, production.m_offset_ns));
+    }
+}
+
+
+/// The first entry is always the production filter.
+///
+std::vector<ShadowFilterStats> ShadowFilters::getStats() const
+{
+    QMutexLocker locker(&m_shared->m_mutex);
+    return m_shared->m_stats;
+}
+
+
+std::string ShadowFilters::getReport() const
+{
+    std::string report;
+    for (const ShadowFilterStats& stats : getStats())
+    {
+        if (!report.empty())
+        {
+            report += " | ";
+        }
+        report += fmt::format("{} pass={:.0f}% diff.us={:.1f} rms.us={:.1f} jitter.us={:.1f} used={:.0f} spread.us={:.1f}",
+                              stats.m_name, stats.passedPct(), stats.meanDiff_us(), stats.rmsDiff_us(),
+                              stats.jitter_us(), stats.usedSamples(), stats.spread_us());
+    }
+    return report;
+}
+
+
+void ShadowFilters::reset()
+{
+    QMutexLocker locker(&m_shared->m_mutex);
+    m_shared->m_stats.clear();
+    m_shared->m_stats.resize(1);
+    m_shared->m_stats.front().m_name = "production";
+    for (const auto& filter : m_filters)
+    {
+        ShadowFilterStats stats;
+        stats.m_name = filter->name();
+        m_shared->m_stats.push_back(stats);
+    }
+}
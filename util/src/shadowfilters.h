@@ -0,0 +1,76 @@
+#pragma once
+
+#include "filterpipeline.h"
+
+#include <QMutex>
+#include <QThreadPool>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/// Running statistics for one filter in shadow mode. Differences are relative to the
+/// production filter for the same burst, the jitter is the rms of the burst to burst
+/// offset changes.
+///
+struct ShadowFilterStats
+{
+    std::string m_name;
+    size_t m_bursts = 0;
+    size_t m_passed = 0;
+    double m_sumDiff_ns = 0.0;
+    double m_sumSquaredDiff_ns = 0.0;
+    double m_sumSquaredJitter_ns = 0.0;
+    size_t m_jitterCount = 0;
+    double m_sumUsedSamples = 0.0;
+    double m_sumSpread_ns = 0.0;
+
+    int m_lastSerial = -1;
+    int64_t m_lastOffset_ns = 0;
+    size_t m_lastUsedSamples = 0;
+    int64_t m_lastSpread_ns = 0;
+
+    void add(int serial, bool passed, int64_t offset_ns, size_t usedSamples, int64_t spread_ns,
+             int64_t production_ns);
+    double meanDiff_us() const;
+    double rmsDiff_us() const;
+    double jitter_us() const;
+    double usedSamples() const;
+    double spread_us() const;
+    double passedPct() const;
+};
+
+
+/// Shadow mode runs a set of filters on a copy of every burst next to the production
+/// filter. The filters run in a thread pool so the main loop is never held up, and the
+/// results are only ever used for statistics.
+///
+class ShadowFilters
+{
+public:
+    ShadowFilters(const std::string& logName);
+    ~ShadowFilters();
+
+    bool setFilters(const std::string& filterList);
+    bool enabled() const;
+    void evaluate(const FilterInput& input, const OffsetMeasurement& production);
+    std::vector<ShadowFilterStats> getStats() const;
+    std::string getReport() const;
+    void reset();
+
+private:
+    class Job;
+
+    struct Shared
+    {
+        QMutex m_mutex;
+        std::vector<ShadowFilterStats> m_stats;
+    };
+
+    std::string m_logName;
+    std::vector<std::shared_ptr<const SampleFilter>> m_filters;
+    std::shared_ptr<Shared> m_shared;
+    QThreadPool m_threadPool;
+    int m_serial = 0;
+};
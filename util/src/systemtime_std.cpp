@@ -2,8 +2,24 @@
 #ifndef VCTCXO
 
 #include "systemtime_std.h"
+#include "timepagewriter.h"
 #include "log.h"
 
+#include <cerrno>
+#include <cstring>
+#include <sys/timex.h>
+
+
+/// Hands the kernel clock back at the frequency it had before the discipline started. A client
+/// that crashes or is terminated by a signal doesn't get here and leaves its frequency in the
+/// kernel, where the next start finds it as the base frequency ('adjtimex -f 0' clears it).
+///
+SystemTime::~SystemTime()
+{
+    setKernelDiscipline(false);
+    delete m_timePage;
+}
+
 
 void SystemTime::setSystemTime(int64_t epoch)
 {
@@ -18,15 +34,24 @@ void SystemTime::setSystemTime(int64_t epoch)
 
 void SystemTime::adjustSystemTime_ns(int64_t adjustment_ns)
 {
-    if (!s_ppmInitialized)
+    if (m_kernelDiscipline && s_ppmInitialized)
+    {
+        // stepped rather than slewed, a kernel slew runs at 500 ppm and a millisecond would
+        // still be moving the clock 2 seconds later, i.e. during the next burst
+        setSystemTime(getRawSystemTime_ns() + adjustment_ns);
+        publishTimePage(true);
+    }
+    else if (!s_ppmInitialized)
     {
         setSystemTime(getRawSystemTime_ns() + adjustment_ns);
         s_resetTime += adjustment_ns;
+        publishTimePage(true);
     }
     else
     {
         int64_t systime = getUpdatedSystemTime(adjustment_ns);
         s_ppmTime = systime;
+        publishTimePage(false);
     }
 }
 
@@ -37,6 +62,12 @@ void SystemTime::reset()
     s_ppmTime = 0;
     s_resetTime = getRawSystemTime_ns();
     s_ppmInitialized = false;
+    if (m_kernelDiscipline)
+    {
+        setKernelFrequency(0.0);
+    }
+    publishTimePage(true);
+    setErrorBound_ns(-1);
 }
 
 
@@ -61,6 +92,11 @@ void SystemTime::setPPM(double ppm)
         s_ppmTime = getUpdatedSystemTime();
         s_ppmInitialized = true;
     }
+    if (m_kernelDiscipline)
+    {
+        setKernelFrequency(s_ppm);
+    }
+    publishTimePage(false);
 }
 
 
@@ -69,4 +105,126 @@ double SystemTime::getPPM()
     return s_ppm;
 }
 
+
+/// Let the kernel run CLOCK_REALTIME at the corrected rate instead of stepping it whenever the
+/// software offset gets too large. The ppm goes in as the kernel frequency, so every process on
+/// the client sees a synchronized clock that only steps on the rare clock adjustments.
+///
+bool SystemTime::setKernelDiscipline(bool enabled)
+{
+    if (enabled == m_kernelDiscipline)
+    {
+        return true;
+    }
+
+    if (enabled)
+    {
+        struct timex tx = {};
+        if (clock_adjtime(CLOCK_REALTIME, &tx) < 0)
+        {
+            trace->error("unable to read the kernel clock frequency, {}", strerror(errno));
+            return false;
+        }
+        m_kernelBaseFrequency = tx.freq;
+        if (tx.status & STA_PLL)
+        {
+            trace->warn("the kernel pll is enabled, is another time daemon running ?");
+        }
+
+        // hand over the software correction to the kernel clock
+        if (s_ppmInitialized)
+        {
+            int64_t systime = getUpdatedSystemTime();
+            setSystemTime(systime);
+            s_ppmTime = systime;
+        }
+        m_kernelDiscipline = true;
+        setKernelFrequency(s_ppm);
+    }
+    else
+    {
+        setKernelFrequency(0.0);
+        m_kernelDiscipline = false;
+        s_ppmTime = getRawSystemTime_ns();
+    }
+
+    trace->info("kernel clock discipline {}, base frequency {:.3f} ppm",
+                enabled ? "on" : "off", m_kernelBaseFrequency / 65536.0);
+    publishTimePage(true);
+    return true;
+}
+
+
+bool SystemTime::kernelDiscipline() const
+{
+    return m_kernelDiscipline;
+}
+
+
+/// The kernel frequency is in ppm with a 16 bit fraction and a positive value makes the clock
+/// run faster, i.e. the opposite sign of the software ppm.
+///
+void SystemTime::setKernelFrequency(double ppm)
+{
+    const long maxFrequency = 500L << 16;
+
+    struct timex tx = {};
+    tx.modes = ADJ_FREQUENCY;
+    tx.freq = m_kernelBaseFrequency - std::lround(ppm * 65536.0);
+    if (std::abs(tx.freq) > maxFrequency)
+    {
+        trace->warn("kernel frequency {:.3f} ppm out of range", tx.freq / 65536.0);
+        tx.freq = tx.freq > 0 ? maxFrequency : -maxFrequency;
+    }
+    if (clock_adjtime(CLOCK_REALTIME, &tx) < 0)
+    {
+        trace->critical("unable to set kernel clock frequency, {}", strerror(errno));
+    }
+}
+
+
+/// Publish the synchronized time in shared memory for local consumers, see timepage.h.
+/// A non shared page is only visible inside the process, as used by libtwitse.
+///
+bool SystemTime::openTimePage(bool shared)
+{
+    if (!m_timePage)
+    {
+        m_timePage = new TimePageWriter;
+    }
+    if (!m_timePage->open(shared ? TWITSE_TIME_PAGE_NAME : ""))
+    {
+        delete m_timePage;
+        m_timePage = nullptr;
+        return false;
+    }
+    publishTimePage(true);
+    return true;
+}
+
+
+const TimePage* SystemTime::getTimePage() const
+{
+    return m_timePage ? m_timePage->page() : nullptr;
+}
+
+
+void SystemTime::setErrorBound_ns(int64_t errorBound_ns)
+{
+    if (m_timePage)
+    {
+        m_timePage->setErrorBound_ns(errorBound_ns);
+    }
+}
+
+
+void SystemTime::publishTimePage(bool stepped)
+{
+    if (m_timePage)
+    {
+        // with kernel discipline the realtime clock is the synchronized time as it is
+        m_timePage->publish(s_ppmTime, 0, m_kernelDiscipline ? 0.0 : s_ppm, s_ppmInitialized, stepped);
+    }
+}
+
 #endif
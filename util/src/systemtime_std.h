@@ -7,10 +7,14 @@
 #include <time.h>
 #include <sys/time.h>
 
+class TimePageWriter;
+struct TimePage;
+
 class SystemTime
 {
 public:
     SystemTime(bool isServer) : m_server(isServer) {}
+    ~SystemTime();
 
     void reset();
 
@@ -28,7 +32,8 @@ public:
     {
         int64_t systime = getRawSystemTime_ns();
 
-        if (!s_ppmInitialized)
+        // with kernel discipline CLOCK_REALTIME already runs at the corrected rate
+        if (!s_ppmInitialized || m_kernelDiscipline)
             return systime;
 
         int64_t offset = - (systime - s_ppmTime) * s_ppm  / 1000000.0;
@@ -39,6 +44,7 @@ public:
             int64_t new_kernel_time = systime + offset + adjustment_ns + empirical_rpi3_correction;
             setSystemTime(new_kernel_time);
             s_ppmTime = new_kernel_time;
+            publishTimePage(true);
             return new_kernel_time;
         }
         return systime + offset;
@@ -65,10 +71,19 @@ public:
 
     double getRunningTime_secs();
 
+    bool setKernelDiscipline(bool enabled);
+    bool kernelDiscipline() const;
+
+    bool openTimePage(bool shared = true);
+    const TimePage* getTimePage() const;
+    void setErrorBound_ns(int64_t errorBound_ns);
+
 private:
+    void publishTimePage(bool stepped);
     int64_t getKernelSystemTime();
 
     void setSystemTime(int64_t epoch);
+    void setKernelFrequency(double ppm);
 
 private:
     bool m_server;
@@ -76,4 +91,9 @@ private:
     int64_t s_ppmTime = 0;
     int64_t s_resetTime = 0;
     bool s_ppmInitialized = false;
+    TimePageWriter* m_timePage = nullptr;
+
+    bool m_kernelDiscipline = false;
+    // the kernel frequency found when the discipline started, in ppm << 16
+    long m_kernelBaseFrequency = 0;
 };
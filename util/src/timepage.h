@@ -0,0 +1,185 @@
+#pragma once
+
+// Header only, so that local consumers like audio players can include this file
+// without anything else from twitse.
+
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+time page
+
+In software mode the synchronized time only exists inside the client as
+
+   server_time = realtime + offset - (realtime - base) * ppm / 1000000             (1)
+
+where realtime is the client CLOCK_REALTIME. The client publishes the terms of (1) in a
+POSIX shared memory page so that local processes can calculate the server time without
+any ipc round trips and, with a vdso clock_gettime, without any syscalls.
+
+The page is protected by a seqlock. The writer makes the sequence odd while it updates
+the page and even when it is done, and a reader retries until it read the same even
+sequence before and after copying the terms, giving up after a number of retries in case
+the writer died in the middle of an update. The generation is bumped whenever the
+client steps the kernel clock or resets, i.e. whenever a consumer should resynchronize
+rather than expect a continuous time.
+
+With the kernel discipline (see SystemTime::setKernelDiscipline) the kernel runs
+CLOCK_REALTIME at the corrected rate and the client publishes a ppm of 0.
+*/
+
+#define TWITSE_TIME_PAGE_NAME "/twitse_time"
+#define TWITSE_TIME_PAGE_MAGIC 0x74777473
+#define TWITSE_TIME_PAGE_VERSION 1
+#define TWITSE_TIME_PAGE_READ_RETRIES 10000
+
+
+struct TimePage
+{
+    uint32_t m_magic;
+    uint32_t m_version;
+    uint32_t m_sequence;
+    uint32_t m_generation;
+    int64_t m_base_ns;
+    int64_t m_offset_ns;
+    double m_ppm;
+    // the latest offset against the server as measured by the server, -1 if unknown
+    int64_t m_errorBound_ns;
+    // realtime of the latest update
+    int64_t m_updated_ns;
+    // 0 while the client is not synchronized, e.g. before the first ppm adjustment
+    uint32_t m_valid;
+};
+
+
+struct TimePageSnapshot
+{
+    uint32_t m_generation = 0;
+    int64_t m_base_ns = 0;
+    int64_t m_offset_ns = 0;
+    double m_ppm = 0.0;
+    int64_t m_errorBound_ns = -1;
+    int64_t m_updated_ns = 0;
+    bool m_valid = false;
+
+    int64_t serverTime_ns(int64_t realtime_ns) const
+    {
+        return realtime_ns + m_offset_ns - (int64_t) ((realtime_ns - m_base_ns) * m_ppm / 1000000.0);
+    }
+};
+
+
+class TimePageReader
+{
+public:
+    ~TimePageReader()
+    {
+        close();
+    }
+
+    bool open(const char* name = TWITSE_TIME_PAGE_NAME)
+    {
+        close();
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0)
+        {
+            return false;
+        }
+        void* page = mmap(nullptr, sizeof(TimePage), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (page == MAP_FAILED)
+        {
+            return false;
+        }
+        m_page = static_cast<const TimePage*>(page);
+        if (m_page->m_magic != TWITSE_TIME_PAGE_MAGIC || m_page->m_version != TWITSE_TIME_PAGE_VERSION)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /// Read a page owned by the writer in this process, e.g. the one libtwitse publishes.
+    /// The page stays owned by the writer and is not unmapped by close().
+    ///
+    void attach(const TimePage* page)
+    {
+        close();
+        m_page = page;
+        m_attached = page != nullptr;
+    }
+
+    void close()
+    {
+        if (m_page && !m_attached)
+        {
+            munmap(const_cast<TimePage*>(m_page), sizeof(TimePage));
+        }
+        m_page = nullptr;
+        m_attached = false;
+    }
+
+    /// False if the page is not open or if no consistent copy could be made, i.e. the writer
+    /// is stuck or dead in the middle of an update.
+    ///
+    bool read(TimePageSnapshot& snapshot) const
+    {
+        if (!m_page)
+        {
+            return false;
+        }
+        uint32_t before, after;
+        int retries = TWITSE_TIME_PAGE_READ_RETRIES;
+        do
+        {
+            if (retries-- <= 0)
+            {
+                return false;
+            }
+            before = __atomic_load_n(&m_page->m_sequence, __ATOMIC_ACQUIRE);
+            if (before & 1)
+            {
+                continue;
+            }
+            snapshot.m_generation = __atomic_load_n(&m_page->m_generation, __ATOMIC_RELAXED);
+            snapshot.m_base_ns = __atomic_load_n(&m_page->m_base_ns, __ATOMIC_RELAXED);
+            snapshot.m_offset_ns = __atomic_load_n(&m_page->m_offset_ns, __ATOMIC_RELAXED);
+            __atomic_load(&m_page->m_ppm, &snapshot.m_ppm, __ATOMIC_RELAXED);
+            snapshot.m_errorBound_ns = __atomic_load_n(&m_page->m_errorBound_ns, __ATOMIC_RELAXED);
+            snapshot.m_updated_ns = __atomic_load_n(&m_page->m_updated_ns, __ATOMIC_RELAXED);
+            snapshot.m_valid = __atomic_load_n(&m_page->m_valid, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            after = __atomic_load_n(&m_page->m_sequence, __ATOMIC_RELAXED);
+        }
+        while ((before & 1) || before != after);
+        return true;
+    }
+
+    /// The current server time, false if the page is not open or the client is not synchronized.
+    ///
+    bool serverTime_ns(int64_t& time_ns, int64_t* errorBound_ns = nullptr) const
+    {
+        TimePageSnapshot snapshot;
+        if (!read(snapshot) || !snapshot.m_valid)
+        {
+            return false;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        time_ns = snapshot.serverTime_ns(ts.tv_sec * (int64_t) 1000000000 + ts.tv_nsec);
+        if (errorBound_ns)
+        {
+            *errorBound_ns = snapshot.m_errorBound_ns;
+        }
+        return true;
+    }
+
+private:
+    const TimePage* m_page = nullptr;
+    bool m_attached = false;
+};
@@ -0,0 +1,139 @@
+#include "timepagewriter.h"
+#include "log.h"
+#include "globals.h"
+
+#include <cerrno>
+#include <cstring>
+
+
+TimePageWriter::~TimePageWriter()
+{
+    if (m_page)
+    {
+        munmap(m_page, sizeof(TimePage));
+        if (!m_name.empty())
+        {
+            shm_unlink(m_name.c_str());
+        }
+    }
+}
+
+
+/// An empty name gives a page that is only visible inside the process.
+///
+bool TimePageWriter::open(const std::string& name)
+{
+    if (name.empty())
+    {
+        void* page = mmap(nullptr, sizeof(TimePage), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED)
+        {
+            trace->error("unable to map local time page, {}", strerror(errno));
+            return false;
+        }
+        m_name.clear();
+        m_page = static_cast<TimePage*>(page);
+        initialize();
+        return true;
+    }
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        trace->error("unable to create time page '{}', {}", name, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, sizeof(TimePage)) < 0)
+    {
+        trace->error("unable to size time page '{}', {}", name, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    void* page = mmap(nullptr, sizeof(TimePage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (page == MAP_FAILED)
+    {
+        trace->error("unable to map time page '{}', {}", name, strerror(errno));
+        return false;
+    }
+
+    m_name = name;
+    m_page = static_cast<TimePage*>(page);
+    // an existing page might have been left with an odd sequence by a writer that died
+    // during an update, start over from an even one
+    __atomic_store_n(&m_page->m_sequence, 0, __ATOMIC_RELAXED);
+    initialize();
+
+    trace->info("publishing time page '{}'", name);
+    return true;
+}
+
+
+const TimePage* TimePageWriter::page() const
+{
+    return m_page;
+}
+
+
+void TimePageWriter::initialize()
+{
+    beginWrite();
+    m_page->m_magic = TWITSE_TIME_PAGE_MAGIC;
+    m_page->m_version = TWITSE_TIME_PAGE_VERSION;
+    m_page->m_generation++;
+    m_page->m_base_ns = 0;
+    m_page->m_offset_ns = 0;
+    m_page->m_ppm = 0.0;
+    m_page->m_errorBound_ns = -1;
+    m_page->m_updated_ns = 0;
+    m_page->m_valid = 0;
+    endWrite();
+}
+
+
+void TimePageWriter::publish(int64_t base_ns, int64_t offset_ns, double ppm, bool valid, bool stepped)
+{
+    if (!m_page)
+    {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    beginWrite();
+    if (stepped)
+    {
+        m_page->m_generation++;
+    }
+    m_page->m_base_ns = base_ns;
+    m_page->m_offset_ns = offset_ns;
+    m_page->m_ppm = ppm;
+    m_page->m_updated_ns = ts.tv_sec * NS_IN_SEC + ts.tv_nsec;
+    m_page->m_valid = valid;
+    endWrite();
+}
+
+
+void TimePageWriter::setErrorBound_ns(int64_t errorBound_ns)
+{
+    if (!m_page)
+    {
+        return;
+    }
+    beginWrite();
+    m_page->m_errorBound_ns = errorBound_ns;
+    endWrite();
+}
+
+
+void TimePageWriter::beginWrite()
+{
+    __atomic_store_n(&m_page->m_sequence, m_page->m_sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+void TimePageWriter::endWrite()
+{
+    __atomic_store_n(&m_page->m_sequence, m_page->m_sequence + 1, __ATOMIC_RELEASE);
+}
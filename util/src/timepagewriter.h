@@ -0,0 +1,27 @@
+#pragma once
+
+#include "timepage.h"
+
+#include <string>
+
+
+/// The client side of the time page, see timepage.h.
+///
+class TimePageWriter
+{
+public:
+    ~TimePageWriter();
+
+    bool open(const std::string& name = TWITSE_TIME_PAGE_NAME);
+    void publish(int64_t base_ns, int64_t offset_ns, double ppm, bool valid, bool stepped);
+    void setErrorBound_ns(int64_t errorBound_ns);
+    const TimePage* page() const;
+
+private:
+    void initialize();
+    void beginWrite();
+    void endWrite();
+
+    std::string m_name;
+    TimePage* m_page = nullptr;
+};